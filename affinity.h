@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sched.h>
+
+// parses a cpu list like "0-3,8,10-11" as used by taskset and sysfs,
+// returns an empty list for malformed input
+inline std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while(pos < list.size()) {
+        size_t comma = list.find(',', pos);
+        if(comma == std::string::npos) comma = list.size();
+        std::string item = list.substr(pos, comma - pos);
+        pos = comma + 1;
+        if(item.empty() || item == "\n") continue;
+        char* end;
+        long first = strtol(item.c_str(), &end, 10), last = first;
+        if(end == item.c_str() || first < 0) return std::vector<int>();
+        if(*end == '-') {
+            const char* second = end + 1;
+            last = strtol(second, &end, 10);
+            if(end == second || last < first) return std::vector<int>();
+        }
+        if(*end && *end != '\n') return std::vector<int>();
+        for(long cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// cpus of one numa node as reported by the kernel, empty if it does not exist
+inline std::vector<int> numa_node_cpus(int node) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE* f = fopen(path, "r");
+    if(!f) return std::vector<int>();
+    char line[4096];
+    std::string list = fgets(line, sizeof(line), f)? line: "";
+    fclose(f);
+    return parse_cpu_list(list);
+}
+
+// binds the calling thread to one cpu, a negative cpu leaves it unbound
+inline bool pin_to_cpu(int cpu) {
+    if(cpu < 0) return true;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+// Pins the calling thread to cpu while in scope and then gives it back the
+// cpus it had, for threads of a pool that run the stages of job after job.
+class scoped_pin {
+public:
+    explicit scoped_pin(int cpu): restore_(cpu >= 0 && sched_getaffinity(0, sizeof(saved_), &saved_) == 0) {
+        pin_to_cpu(cpu);
+    }
+    ~scoped_pin() {
+        if(restore_) sched_setaffinity(0, sizeof(saved_), &saved_);
+    }
+
+private:
+    scoped_pin(const scoped_pin&);
+    scoped_pin& operator=(const scoped_pin&);
+
+    cpu_set_t saved_;
+    bool restore_;
+};
+
+// Placement of the pipeline stages. The reader and the writer each get a cpu
+// of their own and the workers share the rest round robin; on a short list
+// everything wraps around. Since all stages run on the cpus of one node the
+// batches they touch first are allocated there and never cross the
+// interconnect between parsing and deflate.
+struct stage_placement {
+    std::vector<int> cpus;
+
+    int reader() const { return at(0); }
+    int writer() const { return at(1); }
+    int worker(int i) const {
+        if(cpus.size() <= 2) return at(i);
+        return cpus[2 + i % (cpus.size() - 2)];
+    }
+
+private:
+    int at(size_t i) const { return cpus.empty()? -1: cpus[i % cpus.size()]; }
+};
@@ -0,0 +1,712 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "digest.h"
+#include "zstd_codec.h"
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(IO_URING_OP_SUPPORTED)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+// alignment of buffers, offsets and sizes for O_DIRECT
+const size_t IO_ALIGN = 4096;
+
+struct io_options {
+    int depth;           // reads or writes kept in flight per file
+    size_t block;        // bytes per read or write
+    bool direct;         // bypass the page cache with O_DIRECT
+    std::string engine;  // auto, uring or threads
+
+    io_options(): depth(4), block(1 << 20), direct(false), engine("auto") {}
+};
+
+struct io_request {
+    int fd;
+    char* buf;
+    size_t len;
+    off_t offset;
+    bool write;
+    ssize_t result;  // bytes transferred or -errno
+    bool done;
+};
+
+class io_engine {
+public:
+    virtual ~io_engine() {}
+    virtual void submit(io_request* r) = 0;
+    virtual void wait(io_request* r) = 0;
+};
+
+// blocking pread/pwrite on a few threads, works on every file system
+class thread_engine: public io_engine {
+public:
+    explicit thread_engine(int threads): stop_(false) {
+        for(int i = 0; i < threads; i++)
+            threads_.push_back(std::thread(&thread_engine::run, this));
+    }
+
+    ~thread_engine() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        todo_.notify_all();
+        for(size_t i = 0; i < threads_.size(); i++)
+            threads_[i].join();
+    }
+
+    void submit(io_request* r) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        r->done = false;
+        queue_.push_back(r);
+        todo_.notify_one();
+    }
+
+    void wait(io_request* r) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [r] { return r->done; });
+    }
+
+private:
+    void run() {
+        for(;;) {
+            io_request* r;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                todo_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+                if(queue_.empty())
+                    return;
+                r = queue_.front();
+                queue_.pop_front();
+            }
+            ssize_t n = r->write? pwrite(r->fd, r->buf, r->len, r->offset): pread(r->fd, r->buf, r->len, r->offset);
+            std::lock_guard<std::mutex> lock(mutex_);
+            r->result = n < 0? -errno: n;
+            r->done = true;
+            done_.notify_all();
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::deque<io_request*> queue_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable todo_, done_;
+};
+
+#ifdef HAVE_IO_URING
+// A bare io_uring driven through the raw syscalls, so no liburing is needed.
+// A ring is used by a single thread, for one file or for all the files that
+// thread writes; past the ring's entries, submit reaps before it queues more.
+class uring_engine: public io_engine {
+public:
+    // returns nullptr when the kernel lacks io_uring or plain read/write ops
+    static uring_engine* create(unsigned entries) {
+        uring_engine* e = new uring_engine();
+        if(!e->setup(entries)) {
+            delete e;
+            return nullptr;
+        }
+        return e;
+    }
+
+    ~uring_engine() {
+        if(sq_ring_ != MAP_FAILED) munmap(sq_ring_, sq_size_);
+        if(cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_size_);
+        if(sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+        if(fd_ >= 0) close(fd_);
+    }
+
+    void submit(io_request* r) {
+        r->done = false;
+        while(in_flight_ >= entries_)
+            if(!reap()) {
+                r->result = -errno;
+                r->done = true;
+                return;
+            }
+        unsigned tail = *sq_tail_;
+        unsigned index = tail & *sq_mask_;
+        io_uring_sqe* sqe = &((io_uring_sqe*)sqes_)[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = r->write? IORING_OP_WRITE: IORING_OP_READ;
+        sqe->fd = r->fd;
+        sqe->addr = (uint64_t)(uintptr_t)r->buf;
+        sqe->len = r->len;
+        sqe->off = r->offset;
+        sqe->user_data = (uint64_t)(uintptr_t)r;
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        long n;
+        while((n = syscall(__NR_io_uring_enter, fd_, 1, 0, 0, NULL, 0)) < 0 && errno == EINTR);
+        if(n < 1) {
+            // the kernel took nothing, so take the entry back and fail the request
+            r->result = n < 0? -errno: -EAGAIN;
+            __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+            r->done = true;
+        } else {
+            in_flight_++;
+        }
+    }
+
+    // reaps completions, in any order, until r is among them
+    void wait(io_request* r) {
+        while(!r->done)
+            if(!reap()) {
+                r->result = -errno;
+                r->done = true;
+            }
+    }
+
+private:
+    uring_engine(): fd_(-1), sq_ring_(MAP_FAILED), cq_ring_(MAP_FAILED), sqes_(MAP_FAILED), in_flight_(0) {}
+
+    // completes one request, waiting for it if none is done; false with errno
+    // set when the kernel fails the wait
+    bool reap() {
+        unsigned head = *cq_head_;
+        while(head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+            if(syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+                return false;
+        io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+        io_request* c = (io_request*)(uintptr_t)cqe->user_data;
+        c->result = cqe->res;
+        c->done = true;
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        in_flight_--;
+        return true;
+    }
+
+    bool setup(unsigned entries) {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd_ = syscall(__NR_io_uring_setup, entries, &p);
+        if(fd_ < 0)
+            return false;
+        std::vector<char> buf(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* probe = (io_uring_probe*)buf.data();
+        if(syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, 256) < 0 ||
+           probe->last_op < IORING_OP_WRITE ||
+           !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) ||
+           !(probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED))
+            return false;
+        entries_ = p.sq_entries;
+        sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if(p.features & IORING_FEAT_SINGLE_MMAP)
+            sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        sq_ring_ = mmap(0, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if(sq_ring_ == MAP_FAILED)
+            return false;
+        if(p.features & IORING_FEAT_SINGLE_MMAP)
+            cq_ring_ = sq_ring_;
+        else
+            cq_ring_ = mmap(0, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        if(cq_ring_ == MAP_FAILED)
+            return false;
+        sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = mmap(0, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if(sqes_ == MAP_FAILED)
+            return false;
+        char* sq = (char*)sq_ring_;
+        char* cq = (char*)cq_ring_;
+        sq_tail_ = (unsigned*)(sq + p.sq_off.tail);
+        sq_mask_ = (unsigned*)(sq + p.sq_off.ring_mask);
+        sq_array_ = (unsigned*)(sq + p.sq_off.array);
+        cq_head_ = (unsigned*)(cq + p.cq_off.head);
+        cq_tail_ = (unsigned*)(cq + p.cq_off.tail);
+        cq_mask_ = (unsigned*)(cq + p.cq_off.ring_mask);
+        cqes_ = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    int fd_;
+    void *sq_ring_, *cq_ring_, *sqes_;
+    size_t sq_size_, cq_size_, sqes_size_;
+    unsigned *sq_tail_, *sq_mask_, *sq_array_;
+    unsigned *cq_head_, *cq_tail_, *cq_mask_;
+    io_uring_cqe* cqes_;
+    unsigned entries_, in_flight_;  // requests the ring holds, and holds now
+};
+#endif
+
+// an engine for depth requests in flight, or for entries when the engine is
+// shared by several files; a thread engine keeps to depth threads either way
+inline io_engine* make_engine(const io_options& o, unsigned entries = 0) {
+#ifdef HAVE_IO_URING
+    if(o.engine != "threads") {
+        io_engine* e = uring_engine::create(std::max<unsigned>(o.depth, entries));
+        if(e || o.engine == "uring") {
+            if(!e) errno = ENOSYS;
+            return e;
+        }
+    }
+#else
+    if(o.engine == "uring") {
+        errno = ENOSYS;
+        return nullptr;
+    }
+#endif
+    return new thread_engine(o.depth);
+}
+
+// one aligned buffer with the request that fills or drains it
+struct io_block {
+    io_request r;
+    char* buf;
+};
+
+inline bool alloc_blocks(std::vector<io_block>& blocks, int n, size_t size) {
+    blocks.resize(n);
+    for(int i = 0; i < n; i++) {
+        void* p;
+        if(posix_memalign(&p, IO_ALIGN, size))
+            return false;
+        blocks[i].buf = (char*)p;
+    }
+    return true;
+}
+
+inline void free_blocks(std::vector<io_block>& blocks) {
+    for(size_t i = 0; i < blocks.size(); i++)
+        free(blocks[i].buf);
+    blocks.clear();
+}
+
+// Sequential reader keeping `depth` reads of `block` bytes ahead of the
+// consumer. Pipes and other unseekable files are read synchronously.
+class async_reader {
+public:
+    async_reader(): fd_(-1), engine_(nullptr), returned_(nullptr), offset_(0), size_(0), eof_(false), seekable_(false) {}
+    ~async_reader() { close(); }
+
+    bool open(const std::string& path, const io_options& o) {
+        opt_ = o;
+        if(opt_.direct)
+            opt_.block = (opt_.block + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN;
+        fd_ = ::open(path.c_str(), O_RDONLY | (opt_.direct? O_DIRECT: 0));
+        if(fd_ < 0 && opt_.direct)
+            fd_ = ::open(path.c_str(), O_RDONLY);
+        if(fd_ < 0)
+            return false;
+        struct stat st;
+        seekable_ = fstat(fd_, &st) == 0 && S_ISREG(st.st_mode);
+        size_ = seekable_? st.st_size: 0;
+        if(!alloc_blocks(blocks_, seekable_? opt_.depth: 1, opt_.block))
+            return false;
+        if(seekable_) {
+            engine_ = make_engine(opt_);
+            if(!engine_)
+                return false;
+            for(size_t i = 0; i < blocks_.size(); i++)
+                free_.push_back(&blocks_[i]);
+            fill();
+        }
+        return true;
+    }
+
+    // next chunk of the file, valid until the following call; 0 at the end of
+    // the file and -1 on error
+    ssize_t next(const char** data) {
+        if(!seekable_) {
+            ssize_t n;
+            while((n = ::read(fd_, blocks_[0].buf, opt_.block)) < 0 && errno == EINTR);
+            *data = blocks_[0].buf;
+            return n;
+        }
+        if(returned_) {
+            free_.push_back(returned_);
+            returned_ = nullptr;
+        }
+        fill();
+        if(in_flight_.empty())
+            return 0;
+        io_block* b = in_flight_.front();
+        in_flight_.pop_front();
+        engine_->wait(&b->r);
+        if(b->r.result < 0) {
+            errno = -b->r.result;
+            free_.push_back(b);
+            return -1;
+        }
+        if((size_t)b->r.result < b->r.len) {
+            // short read, either the end of the file or a network file system
+            // returning less: drop the reads behind it and restart right after
+            drain();
+            off_t end = b->r.offset + b->r.result;
+            struct stat st;
+            if(fstat(fd_, &st) == 0)
+                size_ = st.st_size;
+            eof_ = end >= size_;
+            if(!eof_ && end % IO_ALIGN)
+                fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+            offset_ = end;
+            if(!b->r.result) {
+                free_.push_back(b);
+                return eof_? 0: next(data);
+            }
+        }
+        returned_ = b;
+        *data = b->buf;
+        return b->r.result;
+    }
+
+    void close() {
+        if(fd_ < 0)
+            return;
+        drain();
+        delete engine_;
+        engine_ = nullptr;
+        free_blocks(blocks_);
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+private:
+    void fill() {
+        while(!eof_ && !free_.empty()) {
+            io_block* b = free_.back();
+            free_.pop_back();
+            b->r.fd = fd_;
+            b->r.buf = b->buf;
+            b->r.len = opt_.block;
+            b->r.offset = offset_;
+            b->r.write = false;
+            offset_ += opt_.block;
+            if(offset_ >= size_)
+                eof_ = true;
+            engine_->submit(&b->r);
+            in_flight_.push_back(b);
+        }
+    }
+
+    void drain() {
+        while(!in_flight_.empty()) {
+            engine_->wait(&in_flight_.front()->r);
+            free_.push_back(in_flight_.front());
+            in_flight_.pop_front();
+        }
+    }
+
+    io_options opt_;
+    int fd_;
+    io_engine* engine_;
+    std::vector<io_block> blocks_;
+    std::vector<io_block*> free_;
+    std::deque<io_block*> in_flight_;
+    io_block* returned_;
+    off_t offset_, size_;
+    bool eof_, seekable_;
+};
+
+// Appending writer that gathers data into `block` sized buffers and keeps up
+// to `depth` of them in flight. With O_DIRECT the tail is written padded and
+// the file truncated back to its real size.
+class async_writer {
+public:
+    async_writer(): fd_(-1), engine_(nullptr), own_engine_(false), current_(nullptr), fill_(0), offset_(0), failed_(false), seekable_(false), direct_(false) {}
+    ~async_writer() { close(); }
+
+    // submits to engine when given, which has to outlive the writer and be
+    // used from the same thread, otherwise to an engine of its own
+    bool open(const std::string& path, const io_options& o, io_engine* engine = nullptr) {
+        opt_ = o;
+        opt_.block = (opt_.block + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN;
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+        fd_ = opt_.direct? ::open(path.c_str(), flags | O_DIRECT, 0644): -1;
+        direct_ = fd_ >= 0;
+        if(fd_ < 0)
+            fd_ = ::open(path.c_str(), flags, 0644);
+        if(fd_ < 0)
+            return false;
+        struct stat st;
+        seekable_ = fstat(fd_, &st) == 0 && S_ISREG(st.st_mode);
+        if(!alloc_blocks(blocks_, seekable_? opt_.depth: 1, opt_.block))
+            return false;
+        for(size_t i = 0; i < blocks_.size(); i++)
+            free_.push_back(&blocks_[i]);
+        if(seekable_) {
+            own_engine_ = !engine;
+            engine_ = engine? engine: make_engine(opt_);
+            if(!engine_)
+                return false;
+        }
+        return true;
+    }
+
+    // md5 of every byte written from here on, hashed on t
+    void hash(md5_thread* t) { md5_.start(t); }
+    // complete after close() once the thread is drained
+    md5_stream& digest() { return md5_; }
+
+    void write(const char* data, size_t len) {
+        if(md5_.active())
+            md5_.add(data, len);
+        while(len) {
+            if(!current_) {
+                current_ = take();
+                fill_ = 0;
+            }
+            size_t n = std::min(len, opt_.block - fill_);
+            memcpy(current_->buf + fill_, data, n);
+            fill_ += n;
+            data += n;
+            len -= n;
+            if(fill_ == opt_.block)
+                flush();
+        }
+    }
+
+    // bytes handed to write() so far
+    uint64_t bytes() const { return offset_ + fill_; }
+
+    // returns false if any write failed
+    bool close() {
+        if(fd_ < 0)
+            return !failed_;
+        if(md5_.active())
+            md5_.flush();
+        uint64_t size = bytes();
+        if(current_ && fill_) {
+            if(direct_) {
+                size_t padded = (fill_ + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN;
+                memset(current_->buf + fill_, 0, padded - fill_);
+                fill_ = padded;
+            }
+            flush();
+        }
+        while(!in_flight_.empty())
+            free_.push_back(complete_oldest());
+        if(direct_ && ftruncate(fd_, size) < 0)
+            failed_ = true;
+        if(own_engine_)
+            delete engine_;
+        engine_ = nullptr;
+        free_blocks(blocks_);
+        if(::close(fd_) < 0)
+            failed_ = true;
+        fd_ = -1;
+        return !failed_;
+    }
+
+private:
+    void flush() {
+        io_request& r = current_->r;
+        r.fd = fd_;
+        r.buf = current_->buf;
+        r.len = fill_;
+        r.offset = offset_;
+        r.write = true;
+        offset_ += fill_;
+        fill_ = 0;
+        if(seekable_) {
+            engine_->submit(&r);
+            in_flight_.push_back(current_);
+        } else {
+            r.result = 0;
+            finish(r);
+            free_.push_back(current_);
+        }
+        current_ = nullptr;
+    }
+
+    // a free buffer, waiting for the oldest write if all are in flight
+    io_block* take() {
+        if(!free_.empty()) {
+            io_block* b = free_.back();
+            free_.pop_back();
+            return b;
+        }
+        return complete_oldest();
+    }
+
+    io_block* complete_oldest() {
+        io_block* b = in_flight_.front();
+        in_flight_.pop_front();
+        engine_->wait(&b->r);
+        if(b->r.result < 0)
+            failed_ = true;
+        else
+            finish(b->r);
+        return b;
+    }
+
+    // completes a short write synchronously
+    void finish(io_request& r) {
+        size_t done = r.result;
+        while(done < r.len) {
+            ssize_t n = seekable_? pwrite(fd_, r.buf + done, r.len - done, r.offset + done):
+                                   ::write(fd_, r.buf + done, r.len - done);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0) {
+                failed_ = true;
+                return;
+            }
+            done += n;
+        }
+    }
+
+    io_options opt_;
+    int fd_;
+    io_engine* engine_;
+    bool own_engine_;
+    std::vector<io_block> blocks_;
+    std::vector<io_block*> free_;
+    std::deque<io_block*> in_flight_;
+    io_block* current_;
+    size_t fill_;
+    uint64_t offset_;
+    bool failed_, seekable_, direct_;
+    md5_stream md5_;
+};
+
+// Decoded view of an input file for kseq: gzip (including multi-member files)
+// is inflated straight out of the reader's blocks, so is zstd in a make
+// ZSTD=1 build, anything else is passed through as plain text.
+class input_stream {
+public:
+    input_stream(): gz_(false), zst_(false), member_(false), failed_(false), pending_(nullptr), pending_l_(0) {
+        memset(&zs_, 0, sizeof(zs_));
+    }
+    ~input_stream() {
+        if(gz_) inflateEnd(&zs_);
+    }
+
+    bool open(const std::string& path, const io_options& o) {
+        path_ = path;
+        if(!file_.open(path, o))
+            return false;
+        ssize_t n = file_.next(&pending_);
+        if(n < 0)
+            return false;
+        pending_l_ = n;
+        gz_ = n >= 2 && (unsigned char)pending_[0] == 0x1f && (unsigned char)pending_[1] == 0x8b;
+        if(gz_ && inflateInit2(&zs_, 15 + 16) != Z_OK)
+            return false;
+        zst_ = zstd_magic(pending_, n);
+        return true;
+    }
+
+    bool failed() const { return failed_; }
+    // what failed, for the caller to report where its messages go
+    const std::string& error() const { return error_; }
+
+    int read(char* buf, int len) {
+        if(failed_)
+            return -1;
+        if(zst_)
+#ifdef HAVE_ZSTD
+            return read_zstd(buf, len);
+#else
+            return fail("zstd input needs a build with make ZSTD=1");
+#endif
+        if(!gz_) {
+            if(!pending_l_ && !refill())
+                return failed_? -1: 0;
+            int n = std::min<size_t>(len, pending_l_);
+            memcpy(buf, pending_, n);
+            pending_ += n;
+            pending_l_ -= n;
+            return n;
+        }
+        zs_.next_out = (Bytef*)buf;
+        zs_.avail_out = len;
+        while(zs_.avail_out) {
+            if(!zs_.avail_in) {
+                if(!pending_l_ && !refill())
+                    break;
+                zs_.next_in = (Bytef*)pending_;
+                zs_.avail_in = pending_l_;
+                pending_l_ = 0;
+            }
+            member_ = true;
+            int ret = inflate(&zs_, Z_NO_FLUSH);
+            if(ret == Z_STREAM_END) {
+                inflateReset(&zs_);
+                member_ = false;
+            } else if(ret != Z_OK && ret != Z_BUF_ERROR) {
+                return fail("corrupt gzip data");
+            }
+        }
+        if(zs_.avail_out == (unsigned)len && member_ && !failed_)
+            return fail("truncated gzip data");
+        return failed_? -1: len - zs_.avail_out;
+    }
+
+private:
+#ifdef HAVE_ZSTD
+    int read_zstd(char* buf, int len) {
+        while(true) {
+            bool eof = !pending_l_ && !zd_.flushing() && !refill();
+            if(failed_)
+                return -1;
+            long n = zd_.decode(pending_, pending_l_, buf, len, eof);
+            if(n < 0)
+                return fail("corrupt zstd data");
+            if(n > 0)
+                return n;
+            if(eof)
+                return zd_.mid_frame()? fail("truncated zstd data"): 0;
+        }
+    }
+#endif
+
+    bool refill() {
+        ssize_t n = file_.next(&pending_);
+        if(n < 0)
+            fail(strerror(errno));
+        pending_l_ = n > 0? n: 0;
+        return n > 0;
+    }
+
+    int fail(const char* why) {
+        error_ = "reading " + path_ + ": " + why;
+        failed_ = true;
+        return -1;
+    }
+
+    std::string path_, error_;
+    async_reader file_;
+    z_stream zs_;
+#ifdef HAVE_ZSTD
+    zstd_decoder zd_;
+#endif
+    bool gz_, zst_, member_, failed_;
+    const char* pending_;
+    size_t pending_l_;
+};
+
+inline int input_read(input_stream* in, void* buf, int len) {
+    return in->read((char*)buf, len);
+}
+
+// reads exactly len bytes, false on a short read
+inline bool read_exact(input_stream& in, char* buf, size_t len) {
+    while(len) {
+        int n = in.read(buf, std::min<size_t>(len, 1 << 30));
+        if(n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
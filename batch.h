@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "kseq.h"
+
+// a batch takes no more pairs once a column holds this many bytes, which
+// keeps the uint32_t offsets of the fields of its last pair in range
+const size_t COLUMN_LIMIT = size_t(1) << 31;
+
+// bytes appended back to back; clear() keeps the memory, so refilling a
+// column does not allocate once it has seen a full batch
+struct byte_column {
+    std::vector<char> data;
+    size_t used;
+
+    byte_column(): used(0) {}
+
+    void clear() { used = 0; }
+    const char* at(uint32_t offset) const { return &data[offset]; }
+
+    // copies l bytes padded with zeros to width, plus a NUL, and returns
+    // their offset
+    uint32_t append(const char* s, size_t l, size_t width) {
+        if(used + width + 1 > data.size())
+            data.resize(std::max(data.size() * 2, used + width + 1 + (1 << 20)));
+        uint32_t offset = used;
+        if(l) memcpy(&data[used], s, l);
+        memset(&data[used + l], 0, width - l + 1);
+        used += width + 1;
+        return offset;
+    }
+
+    void prefault(size_t bytes) {
+        if(data.size() < bytes)
+            data.resize(bytes);
+        memset(data.data(), 0, data.size());
+    }
+};
+
+// formatted and compressed pairs of one sample when demultiplexing
+struct sample_output {
+    uint32_t pairs;
+    std::string text[2];
+    std::string out[2];
+    uint32_t crc[2];  // CRC32 of text
+
+    sample_output(): pairs(0), crc() {}
+};
+
+// N read pairs stored as columns, so that the filter kernels stream over the
+// qualities or bases of many reads at once. Read1 of pair i is read 2*i and
+// read2 is read 2*i+1; the qualities of a read sit at the offset of its
+// bases. clear() keeps every buffer's capacity, so once a batch has seen a
+// full load it is refilled without touching malloc.
+struct read_batch {
+    uint64_t id;
+    size_t pairs;
+    byte_column names;  // name and comment of every read
+    byte_column bases;
+    byte_column quals;
+    std::vector<uint32_t> name_at, name_l, comment_l, seq_at, seq_l;
+    std::vector<unsigned char> pass;  // reads passing every read level filter
+    std::vector<uint32_t> selected;   // pairs whose reads both pass
+    std::vector<uint64_t> hashes;     // name hash of every selected pair when sampling a reservoir
+    std::string packed[2];  // fqb blocks of read1/read2 when decoding
+    std::string text[2];    // formatted fastq of out1/out2
+    std::string out[2];     // compressed gzip member or fqb block of out1/out2
+    uint32_t crc[2];        // CRC32 of text, taken while compressing it
+    std::vector<sample_output> samples;  // in place of text and out when demultiplexing
+    std::string merged_text, merged_out;  // pairs merged into one read, fastq and compressed
+    uint32_t merged_pairs, merged_crc;
+    uint32_t decoded_pairs;  // pairs in the fqb blocks when decoding, nothing is selected then
+    sample_output screened;  // pairs hitting the screen, formatted only when routed to their own files
+    bool damaged;
+    bool compress_failed;  // zstd failed on a text, so an out is missing
+    std::atomic<uint32_t> next;
+
+    read_batch(): id(0), pairs(0), crc(), merged_pairs(0), merged_crc(0), decoded_pairs(0), damaged(false),
+        compress_failed(false), next(0) {}
+
+    void clear() {
+        pairs = 0;
+        merged_pairs = 0;
+        decoded_pairs = 0;
+        screened.pairs = 0;
+        damaged = false;
+        compress_failed = false;
+        names.clear();
+        bases.clear();
+        quals.clear();
+        name_at.clear();
+        name_l.clear();
+        comment_l.clear();
+        seq_at.clear();
+        seq_l.clear();
+        selected.clear();
+    }
+
+    // writes every page of the buffers once so that they are backed by
+    // memory of the node the calling thread runs on (first touch)
+    void prefault(size_t column_bytes, size_t text_bytes) {
+        names.prefault(column_bytes / 4);
+        bases.prefault(column_bytes);
+        quals.prefault(column_bytes);
+        for(int i = 0; i < 2; i++) {
+            text[i].assign(text_bytes, '\0');
+            text[i].clear();
+            out[i].assign(text_bytes, '\0');
+            out[i].clear();
+        }
+    }
+
+    void add_pair(const kstring_t* name1, const kstring_t* comment1, const kstring_t* seq1, const kstring_t* qual1,
+        const kstring_t* name2, const kstring_t* comment2, const kstring_t* seq2, const kstring_t* qual2) {
+        add_read(name1, comment1, seq1, qual1);
+        add_read(name2, comment2, seq2, qual2);
+        pairs++;
+    }
+
+    // past COLUMN_LIMIT in a column, add no more pairs then
+    bool full() const { return std::max(names.used, std::max(bases.used, quals.used)) >= COLUMN_LIMIT; }
+
+    size_t reads() const { return seq_l.size(); }
+    const char* name(size_t r) const { return names.at(name_at[r]); }
+    const char* comment(size_t r) const { return names.at(name_at[r] + name_l[r] + 1); }
+    const char* seq(size_t r) const { return bases.at(seq_at[r]); }
+    const char* qual(size_t r) const { return quals.at(seq_at[r]); }
+
+private:
+    // reads without qualities (fasta) get zeros and never pass the filter
+    void add_read(const kstring_t* name, const kstring_t* comment, const kstring_t* seq, const kstring_t* qual) {
+        name_at.push_back(names.append(name->s, name->l, name->l));
+        names.append(comment->s, comment->l, comment->l);
+        name_l.push_back(name->l);
+        comment_l.push_back(comment->l);
+        seq_at.push_back(bases.append(seq->s, seq->l, seq->l));
+        quals.append(qual->s, std::min(qual->l, seq->l), seq->l);
+        seq_l.push_back(seq->l);
+    }
+};
+
+// Fixed set of batches recycled through a lock-free free-list. The head packs
+// a generation tag above the (index + 1) of the first free batch, so a batch
+// popped and pushed back between a load and its CAS cannot be mistaken for
+// the old head (ABA).
+class batch_pool {
+public:
+    explicit batch_pool(size_t n): batches_(new read_batch[n]), size_(n), head_(0) {
+        for(size_t i = 0; i < n; i++)
+            release(&batches_[i]);
+    }
+
+    size_t size() const { return size_; }
+
+    void prefault(size_t slab_bytes, size_t text_bytes) {
+        for(size_t i = 0; i < size_; i++)
+            batches_[i].prefault(slab_bytes, text_bytes);
+    }
+
+    read_batch* try_acquire() {
+        uint64_t old = head_.load(std::memory_order_acquire);
+        for(;;) {
+            uint32_t index = old & 0xffffffffu;
+            if(!index)
+                return nullptr;
+            read_batch* b = &batches_[index - 1];
+            uint64_t head = (((old >> 32) + 1) << 32) | b->next.load(std::memory_order_relaxed);
+            if(head_.compare_exchange_weak(old, head, std::memory_order_acq_rel, std::memory_order_acquire))
+                return b;
+        }
+    }
+
+    // waits for a batch to come back from the writer when all are in flight
+    read_batch* acquire() {
+        for(int spin = 0; ; spin++) {
+            read_batch* b = try_acquire();
+            if(b)
+                return b;
+            if(spin < 64)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    void release(read_batch* b) {
+        uint64_t index = b - batches_.get() + 1;
+        uint64_t old = head_.load(std::memory_order_relaxed), head;
+        do {
+            b->next.store(old & 0xffffffffu, std::memory_order_relaxed);
+            head = (((old >> 32) + 1) << 32) | index;
+        } while(!head_.compare_exchange_weak(old, head, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+private:
+    std::unique_ptr<read_batch[]> batches_;
+    size_t size_;
+    std::atomic<uint64_t> head_;
+};
+
+// bounded channel handing batches from one stage to the next, it never
+// holds more than the pool owns so the ring is allocated once
+class batch_queue {
+public:
+    explicit batch_queue(size_t capacity): ring_(capacity), head_(0), count_(0), closed_(false) {}
+
+    void push(read_batch* b) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ring_[(head_ + count_) % ring_.size()] = b;
+        count_++;
+        ready_.notify_one();
+    }
+
+    // returns nullptr once the queue is closed and drained
+    read_batch* pop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this] { return count_ || closed_; });
+        if(!count_)
+            return nullptr;
+        read_batch* b = ring_[head_];
+        head_ = (head_ + 1) % ring_.size();
+        count_--;
+        return b;
+    }
+
+    // batches waiting right now
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return count_;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        ready_.notify_all();
+    }
+
+private:
+    std::vector<read_batch*> ring_;
+    size_t head_, count_;
+    bool closed_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+};
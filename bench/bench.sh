@@ -0,0 +1,79 @@
+#!/bin/bash
+# Throughput benchmarks of the filter tool, best of $RUNS runs each:
+#
+#   bench/bench.sh modes READ1 READ2 FILTER...
+#       the mode combinations the per-record loop is specialized on, for
+#       every binary given, e.g. one built from an older revision and ./filter
+#   bench/bench.sh order READ1 READ2 FILTER...
+#       ordered output against --unordered on $THREADS workers; the gap only
+#       shows with several cpus and uneven batch times
+#   bench/bench.sh reorder READ1 READ2 FILTER
+#       input order against --reorder minimizer, and umi when $UMI has the
+#       options that extract one, in size, ratio of fastq to gzip, and time
+#
+# RUNS (default 3), THREADS (default 4) and LEVEL (default 4) tune them.
+set -e
+
+suite=$1 read1=$2 read2=$3
+shift 3 || true
+if [ -z "$suite" ] || [ -z "$read1" ] || [ -z "$read2" ] || [ $# -lt 1 ]; then
+    sed -n '2,14p' "$0" >&2
+    exit 1
+fi
+RUNS=${RUNS:-3}
+THREADS=${THREADS:-4}
+LEVEL=${LEVEL:-4}
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+# best wall time in ms of RUNS runs of filter with the options, outputs in $out
+best() {
+    local filter=$1 ms best=
+    shift
+    for run in $(seq "$RUNS"); do
+        local start=$(date +%s%N)
+        "$filter" -1 "$read1" -2 "$read2" -3 "$out/1.gz" -4 "$out/2.gz" --level "$LEVEL" "$@" 2> "$out/log" ||
+            { cat "$out/log" >&2; exit 1; }
+        ms=$((($(date +%s%N) - start) / 1000000))
+        if [ -z "$best" ] || [ "$ms" -lt "$best" ]; then best=$ms; fi
+    done
+    echo "$best"
+}
+
+output_bytes() { echo $(($(stat -c %s "$out/1.gz") + $(stat -c %s "$out/2.gz"))); }
+
+case $suite in
+modes)
+    printf '%-40s %-60s %10s\n' binary options ms
+    for filter in "$@"; do
+        for options in "" "--disComment" "--umi --umiStart 0 --umiLength 6 --readStart 7" \
+                       "--umi --umiStart 0 --umiLength 6 --readStart 7 --disComment" \
+                       "--structure1 140T --structure2 140T"; do
+            printf '%-40s %-60s %10s\n' "$filter" "${options:-(defaults)}" "$(best "$filter" -t 1 $options)"
+        done
+    done
+    ;;
+order)
+    printf '%-40s %10s %12s\n' binary ordered unordered
+    for filter in "$@"; do
+        printf '%-40s %8s ms %9s ms\n' "$filter" "$(best "$filter" -t "$THREADS")" \
+                                        "$(best "$filter" -t "$THREADS" --unordered)"
+    done
+    ;;
+reorder)
+    filter=$1
+    printf '%-12s %12s %8s %10s\n' order bytes ratio ms
+    keys="none minimizer"
+    [ -n "$UMI" ] && keys="$keys umi"
+    for key in $keys; do
+        ms=$(best "$filter" -t "$THREADS" $UMI --reorder "$key" --manifest "$out/manifest")
+        fastq=$(awk '!/^#/ {s += $3} END {print s}' "$out/manifest")
+        bytes=$(output_bytes)
+        printf '%-12s %12s %8s %10s\n' "$key" "$bytes" "$(awk "BEGIN {printf \"%.2f\", $fastq / $bytes}")" "$ms"
+    done
+    ;;
+*)
+    sed -n '2,14p' "$0" >&2
+    exit 1
+    ;;
+esac
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "umi.h"
+
+// Samples to demultiplex into, read from a sheet with one sample per line:
+// its name and its barcode separated by white space. Dual index barcodes may
+// be written as ACGTACGT+TTGGCCAA, the '+' is dropped. Blank lines and lines
+// starting with '#' are skipped. Pairs matching no barcode go to the sample
+// past the last, named undetermined.
+class sample_sheet {
+public:
+    bool load(const std::string& path, bool mismatches, std::string& error) {
+        std::ifstream in(path.c_str());
+        if(!in) {
+            error = "can not open " + path;
+            return false;
+        }
+        std::vector<uint64_t> barcodes;
+        int length = 0;
+        std::string line;
+        while(std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string name, barcode, extra;
+            if(!(fields >> name) || name[0] == '#')
+                continue;
+            if(!(fields >> barcode) || fields >> extra) {
+                error = "sample sheet line '" + line + "' is not a name and a barcode";
+                return false;
+            }
+            if(name == undetermined() || name.find('/') != std::string::npos ||
+               std::find(names_.begin(), names_.end(), name) != names_.end()) {
+                error = "sample name " + name + " is reserved, repeated or has a '/'";
+                return false;
+            }
+            barcode.erase(std::remove(barcode.begin(), barcode.end(), '+'), barcode.end());
+            uint64_t key;
+            if(barcode.empty() || barcode.size() > 31 || !encode_umi(barcode.data(), barcode.size(), key)) {
+                error = "barcode " + barcode + " of sample " + name + " is not 1 to 31 ACGT bases";
+                return false;
+            }
+            if(length && (int)barcode.size() != length) {
+                error = "barcode of sample " + name + " is not " + std::to_string(length) + " bases like the ones before";
+                return false;
+            }
+            if(std::find(barcodes.begin(), barcodes.end(), key) != barcodes.end()) {
+                error = "barcode " + barcode + " of sample " + name + " is already taken";
+                return false;
+            }
+            length = barcode.size();
+            names_.push_back(name);
+            barcodes.push_back(key);
+        }
+        if(names_.empty()) {
+            error = "no samples in " + path;
+            return false;
+        }
+        index_.build(barcodes, length, mismatches);
+        return true;
+    }
+
+    // samples in the sheet, undetermined not counted
+    size_t size() const { return names_.size(); }
+    const std::string& name(size_t i) const { return i < names_.size()? names_[i]: undetermined(); }
+    int barcode_length() const { return index_.length(); }
+
+    // sample of a barcode of barcode_length() bases, size() for none
+    size_t match(const char* barcode) const {
+        bool exact;
+        int i = index_.find(barcode, exact);
+        return i < 0? names_.size(): i;
+    }
+
+private:
+    static const std::string& undetermined() {
+        static const std::string name("undetermined");
+        return name;
+    }
+
+    std::vector<std::string> names_;
+    neighbour_index index_;
+};
+
+// the index read from an Illumina comment like 1:N:0:ACGTACGT+TTGGCCAA,
+// without the '+'
+inline void index_barcode(const char* comment, size_t l, std::string& barcode) {
+    barcode.clear();
+    size_t i = l;
+    while(i && comment[i - 1] != ':') i--;
+    for(; i < l; i++)
+        if(comment[i] != '+') barcode += comment[i];
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <zlib.h>
+
+// MD5 (RFC 1321), what sequencing cores and LIMS check files against
+class md5 {
+public:
+    md5(): length_(0) {
+        h_[0] = 0x67452301;
+        h_[1] = 0xefcdab89;
+        h_[2] = 0x98badcfe;
+        h_[3] = 0x10325476;
+    }
+
+    void update(const char* p, size_t l) {
+        size_t held = length_ % 64;
+        length_ += l;
+        if(held) {
+            size_t n = std::min(l, 64 - held);
+            memcpy(block_ + held, p, n);
+            p += n;
+            l -= n;
+            if(held + n < 64)
+                return;
+            transform((const unsigned char*)block_);
+        }
+        for(; l >= 64; p += 64, l -= 64)
+            transform((const unsigned char*)p);
+        memcpy(block_, p, l);
+    }
+
+    uint64_t bytes() const { return length_; }
+
+    // the digest in hex, ends the hash
+    std::string hex() {
+        uint64_t bits = length_ * 8;
+        char pad[72] = {(char)0x80};
+        update(pad, 1 + (119 - length_ % 64) % 64);
+        for(int i = 0; i < 8; i++) pad[i] = (char)(bits >> (8 * i));
+        update(pad, 8);
+        length_ = bits / 8;
+        static const char digits[] = "0123456789abcdef";
+        std::string out;
+        for(int w = 0; w < 4; w++)
+            for(int i = 0; i < 4; i++) {
+                unsigned char byte = h_[w] >> (8 * i);
+                out += digits[byte >> 4];
+                out += digits[byte & 15];
+            }
+        return out;
+    }
+
+private:
+    static uint32_t rotate(uint32_t x, int c) { return (x << c) | (x >> (32 - c)); }
+
+    void transform(const unsigned char* p) {
+        static const uint32_t K[64] = {
+            0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+            0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+            0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+            0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+            0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+            0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+            0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+            0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+        static const int S[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+        uint32_t m[16];
+        for(int i = 0; i < 16; i++)
+            m[i] = p[4 * i] | (p[4 * i + 1] << 8) | (p[4 * i + 2] << 16) | ((uint32_t)p[4 * i + 3] << 24);
+        uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3];
+        for(int i = 0; i < 64; i++) {
+            uint32_t f;
+            int g;
+            if(i < 16) {
+                f = (b & c) | (~b & d);
+                g = i;
+            } else if(i < 32) {
+                f = (d & b) | (~d & c);
+                g = (5 * i + 1) % 16;
+            } else if(i < 48) {
+                f = b ^ c ^ d;
+                g = (3 * i + 5) % 16;
+            } else {
+                f = c ^ (b | ~d);
+                g = (7 * i) % 16;
+            }
+            uint32_t t = d;
+            d = c;
+            c = b;
+            b += rotate(a + f + K[i] + m[g], S[(i / 16) * 4 + i % 4]);
+            a = t;
+        }
+        h_[0] += a;
+        h_[1] += b;
+        h_[2] += c;
+        h_[3] += d;
+    }
+
+    uint32_t h_[4];
+    uint64_t length_;
+    char block_[64];
+};
+
+// Hashes the bytes of every output on a thread of its own, chunks of one
+// stream in the order they were handed over. At most MAX_QUEUED bytes wait,
+// beyond that the writer waits for the thread.
+class md5_thread {
+public:
+    md5_thread(): queued_(0), stop_(false), thread_([this] { run(); }) {}
+
+    ~md5_thread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        changed_.notify_all();
+        thread_.join();
+    }
+
+    // takes the bytes of chunk, which is left empty
+    void add(md5* m, std::string& chunk) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return queued_ < MAX_QUEUED; });
+        queued_ += chunk.size();
+        jobs_.push_back(job());
+        jobs_.back().m = m;
+        jobs_.back().chunk.swap(chunk);
+        changed_.notify_all();
+    }
+
+    // waits until every chunk handed over is hashed
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return jobs_.empty(); });
+    }
+
+private:
+    static const size_t MAX_QUEUED = 64 << 20;
+
+    struct job {
+        md5* m;
+        std::string chunk;
+    };
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for(;;) {
+            changed_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+            if(jobs_.empty())
+                return;
+            job& j = jobs_.front();
+            lock.unlock();
+            j.m->update(j.chunk.data(), j.chunk.size());
+            lock.lock();
+            queued_ -= j.chunk.size();
+            jobs_.pop_front();
+            changed_.notify_all();
+        }
+    }
+
+    std::deque<job> jobs_;
+    size_t queued_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::thread thread_;
+};
+
+// The md5 of one output file, its bytes gathered into chunks for the thread
+// as they are written. The digest is there once the stream is flushed and
+// the thread drained.
+class md5_stream {
+public:
+    md5_stream(): thread_(nullptr) {}
+
+    void start(md5_thread* t) { thread_ = t; }
+    bool active() const { return thread_ != nullptr; }
+
+    void add(const char* p, size_t l) {
+        pending_.append(p, l);
+        if(pending_.size() >= CHUNK)
+            thread_->add(&md5_, pending_);
+    }
+
+    void flush() {
+        if(!pending_.empty())
+            thread_->add(&md5_, pending_);
+    }
+
+    std::string hex() { return md5_.hex(); }
+    uint64_t bytes() const { return md5_.bytes(); }
+
+private:
+    static const size_t CHUNK = 1 << 20;
+
+    md5_thread* thread_;
+    std::string pending_;
+    md5 md5_;
+};
+
+// CRC32 of a stream compressed in blocks by the workers, combined in write
+// order from the CRC of every block. A gzip member carries the CRC32 of its
+// text, so for gzip output the blocks' CRCs come free with deflate.
+struct stream_crc {
+    uint32_t crc;
+    uint64_t bytes;
+
+    stream_crc(): crc(0), bytes(0) {}
+
+    void add(uint32_t block, uint64_t length) {
+        crc = crc32_combine(crc, block, length);
+        bytes += length;
+    }
+};
@@ -0,0 +1,255 @@
+#include "fastqfilter.h"
+
+uint32_t compress_block(z_stream* zs, const std::string& text, std::string& out) {
+    deflateReset(zs);
+    out.resize(deflateBound(zs, text.size()));
+    zs->next_in = (Bytef*)text.data();
+    zs->avail_in = text.size();
+    zs->next_out = (Bytef*)&out[0];
+    zs->avail_out = out.size();
+    deflate(zs, Z_FINISH);
+    out.resize(zs->total_out);
+    return zs->adler;
+}
+
+void compress_texts(z_stream* zs, const std::string* text, std::string* out, uint32_t* crc) {
+    for(int i = 0; i < 2; i++) {
+        crc[i] = 0;
+        if(text[i].empty())
+            out[i].clear();
+        else
+            crc[i] = compress_block(zs, text[i], out[i]);
+    }
+}
+
+#ifdef HAVE_ZSTD
+uint32_t text_crc(const filter_config& c, const std::string& text) {
+    return c.checksums? crc32(0, (const Bytef*)text.data(), text.size()): 0;
+}
+
+bool zstd_texts(zstd_compressor& zc, const filter_config& c, const std::string* text, std::string* out, uint32_t* crc) {
+    bool ok = true;
+    for(int i = 0; i < 2; i++) {
+        crc[i] = text_crc(c, text[i]);
+        if(text[i].empty())
+            out[i].clear();
+        else
+            ok = zc.compress(text[i], out[i], c.level, c.dict) && ok;
+    }
+    return ok;
+}
+
+bool train_dictionary(const read_batch* b, int level, zstd_dictionary& dict, std::string& error) {
+    std::string samples;
+    std::vector<size_t> sizes;
+    for(size_t r = 0; r < 2 * b->pairs; r++) {
+        size_t start = samples.size();
+        samples += '@';
+        samples.append(b->name(r), b->name_l[r]);
+        if(b->comment_l[r]) {
+            samples += ' ';
+            samples.append(b->comment(r), b->comment_l[r]);
+        }
+        samples += '\n';
+        samples.append(b->seq(r), b->seq_l[r]);
+        samples += "\n+\n";
+        samples.append(b->qual(r), b->seq_l[r]);
+        samples += '\n';
+        sizes.push_back(samples.size() - start);
+    }
+    if(!dict.train(samples, sizes, error))
+        return false;
+    zstd_compressor zc;
+    std::string with, without;
+    dict.prepare(level);
+    zc.compress(samples, with, level, &dict);
+    zc.compress(samples, without, level, nullptr);
+    if(with.size() + dict.frame().size() >= without.size()) {
+        dict.clear();
+        error = "it does not pay off on the first pairs";
+        return false;
+    }
+    return true;
+}
+#endif
+
+bool fill_batch(kseq_t* reads1, kseq_t* reads2, read_limits& limits, read_batch* b) {
+    b->clear();
+    while(b->pairs < BATCH_PAIRS && !b->full()) {
+        if(limits.exhausted() || kseq_read(reads1) < 0 || kseq_read(reads2) < 0)
+            return false;
+        if(limits.take(&reads1->name))
+            b->add_pair(&reads1->name, &reads1->comment, &reads1->seq, &reads1->qual,
+                        &reads2->name, &reads2->comment, &reads2->seq, &reads2->qual);
+    }
+    return true;
+}
+
+void read_pairs(kseq_t* reads1, kseq_t* reads2, read_limits& limits, batch_pool& pool, batch_queue& todo, uint64_t id,
+    trace_ring* trace) {
+    for(bool more = true; more; id++) {
+        uint64_t start = trace? trace->now(): 0;
+        read_batch* b = pool.acquire();
+        if(trace) {
+            trace->span("wait for a batch", id, start);
+            start = trace->now();
+        }
+        more = fill_batch(reads1, reads2, limits, b);
+        b->id = id;
+        todo.push(b);
+        if(trace) {
+            trace->span("read", id, start);
+            trace->counter("todo", todo.size());
+        }
+    }
+    todo.close();
+}
+
+bool build_screen(const std::string& path, int k, const io_options& io, kmer_screen& screen, std::string& error) {
+    uint64_t kmers = 0;
+    for(int pass = 0; pass < 2; pass++) {
+        input_stream in;
+        if(!in.open(path, io)) {
+            error = "can not open " + path + ": " + strerror(errno);
+            return false;
+        }
+        if(pass)
+            screen.reset(k, kmers);
+        kseq_t* seqs = kseq_init(&in);
+        while(kseq_read(seqs) >= 0) {
+            if(pass)
+                screen.add(seqs->seq.s, seqs->seq.l);
+            else if(seqs->seq.l >= (size_t)k)
+                kmers += seqs->seq.l - k + 1;
+        }
+        kseq_destroy(seqs);
+        if(in.failed()) {
+            error = in.error();
+            return false;
+        }
+        if(!kmers) {
+            error = path + " has no sequence of " + std::to_string(k) + " bases";
+            return false;
+        }
+    }
+    return true;
+}
+
+int batch_phred(const read_batch* b) {
+    int min_qual = 255, max_qual = 0;
+    for(size_t i = 0; i < b->reads(); i++) {
+        const unsigned char* q = (const unsigned char*)b->qual(i);
+        for(uint32_t j = 0; j < b->seq_l[i]; j++) {
+            min_qual = std::min<int>(min_qual, q[j]);
+            max_qual = std::max<int>(max_qual, q[j]);
+        }
+    }
+    return detect_phred(min_qual, max_qual);
+}
+
+void split_samples(read_batch* b, const filter_config& c, worker_scratch& w) {
+    size_t n = b->selected.size(), samples = c.samples->size() + 1;
+    int length = c.samples->barcode_length();
+    b->samples.resize(samples);
+    w.first.assign(samples, 0);
+    w.sample.resize(n);
+    for(size_t s = 0; s < n; s++) {
+        size_t read1 = 2 * b->selected[s];
+        if(c.inline_barcode) {
+            w.barcode.clear();
+            append_segments(w.barcode, c.plan[0].barcode, b->seq(read1));
+            append_segments(w.barcode, c.plan[1].barcode, b->seq(read1 + 1));
+        } else {
+            index_barcode(b->comment(read1), b->comment_l[read1], w.barcode);
+        }
+        w.sample[s] = (int)w.barcode.size() == length? c.samples->match(w.barcode.data()): samples - 1;
+        w.first[w.sample[s]]++;
+    }
+    for(size_t k = 0, at = 0; k < samples; k++) {
+        b->samples[k].pairs = w.first[k];
+        w.first[k] = at;
+        at += b->samples[k].pairs;
+    }
+    w.sorted.resize(n);
+    for(size_t s = 0; s < n; s++)
+        w.sorted[w.first[w.sample[s]]++] = b->selected[s];
+    b->selected.swap(w.sorted);
+}
+
+void prune_to_reservoir(read_batch* b, const filter_config& c) {
+    uint64_t threshold = c.reservoir->threshold();
+    size_t n = b->selected.size(), kept = 0;
+    b->hashes.resize(n);
+    for(size_t s = 0; s < n; s++) {
+        size_t read1 = 2 * b->selected[s];
+        uint64_t h = name_hash(b->name(read1), b->name_l[read1], c.seed);
+        b->selected[kept] = b->selected[s];
+        b->hashes[kept] = h;
+        kept += h < threshold;
+    }
+    b->selected.resize(kept);
+    b->hashes.resize(kept);
+}
+
+template batch_filter<keep_pairs> select_filter<keep_pairs>(const filter_config& c);
+
+bool compress_batch(read_batch* b, const filter_config& c, worker_scratch& w, z_stream* zs) {
+    if(c.zstd) {
+#ifdef HAVE_ZSTD
+        bool ok = zstd_texts(w.zstd, c, b->text, b->out, b->crc);
+        for(size_t k = 0; k < b->samples.size(); k++)
+            ok = zstd_texts(w.zstd, c, b->samples[k].text, b->samples[k].out, b->samples[k].crc) && ok;
+        if(b->merged_pairs) {
+            ok = w.zstd.compress(b->merged_text, b->merged_out, c.level, c.dict) && ok;
+            b->merged_crc = text_crc(c, b->merged_text);
+        }
+        if(c.route_screened)
+            ok = zstd_texts(w.zstd, c, b->screened.text, b->screened.out, b->screened.crc) && ok;
+        return ok;
+#else
+        (void)w;  // only zstd compresses with the worker's scratch
+#endif
+    } else if(!c.packed) {
+        compress_texts(zs, b->text, b->out, b->crc);
+        for(size_t k = 0; k < b->samples.size(); k++)
+            compress_texts(zs, b->samples[k].text, b->samples[k].out, b->samples[k].crc);
+        if(b->merged_pairs)
+            b->merged_crc = compress_block(zs, b->merged_text, b->merged_out);
+        if(c.route_screened)
+            compress_texts(zs, b->screened.text, b->screened.out, b->screened.crc);
+    }
+    return true;
+}
+
+void write_batch(std::vector<output_files>& files, const read_batch* b) {
+    if(b->samples.empty())
+        files[0].write(b->out, b->selected.size() + b->decoded_pairs, b->text, b->crc);
+    for(size_t k = 0; k < b->samples.size(); k++)
+        files[k].write(b->samples[k].out, b->samples[k].pairs, b->samples[k].text, b->samples[k].crc);
+    if(b->merged_pairs) {
+        files[0].merged.write(b->merged_out.data(), b->merged_out.size());
+        files[0].merged_crc.add(b->merged_crc, b->merged_text.size());
+        files[0].merged_pairs += b->merged_pairs;
+    }
+    for(int i = 0; i < 2; i++) {
+        files[0].screened[i].write(b->screened.out[i].data(), b->screened.out[i].size());
+        files[0].screened_crc[i].add(b->screened.crc[i], b->screened.text[i].size());
+    }
+    files[0].screened_pairs += b->screened.pairs;
+}
+
+bool close_file(async_writer& f, int level, bool gzip, const fqb_index* index) {
+    if(index) {
+        std::string trailer = index->trailer();
+        f.write(trailer.data(), trailer.size());
+    } else if(gzip && f.bytes() == 0) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+        std::string out;
+        compress_block(&zs, "", out);
+        deflateEnd(&zs);
+        f.write(out.data(), out.size());
+    }
+    return f.close();
+}
@@ -0,0 +1,563 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "kseq.h"
+#include "batch.h"
+#include "aio.h"
+#include "quality.h"
+#include "fqb.h"
+#include "umi.h"
+#include "structure.h"
+#include "demux.h"
+#include "sampling.h"
+#include "level.h"
+#include "merge.h"
+#include "screen.h"
+#include "reorder.h"
+#include "zstd_codec.h"
+#include "trace.h"
+KSEQ_INIT(input_stream*, input_read)
+
+// libfastqfilter: the parser, filter chain, UMI handling and output formats
+// of the filter tool, for programs that run them in-process on pairs they
+// already hold. The per read loops are templates here so that they inline
+// into the caller; what runs once per batch is in fastqfilter.cpp.
+
+// read pairs per batch handed from the reader to the workers
+const size_t BATCH_PAIRS = 4096;
+
+struct filter_config {
+    int cutQ;
+    int level;
+    bool add_comment;
+    bool treat_umi;
+    char prefix;
+    read_plan plan[2];  // where the UMI and template sit in read1 and read2
+    int max_n;
+    int phred;
+    quality_bins bins;
+    const umi_corrector* umis;  // nullptr unless UMIs are corrected
+    const sample_sheet* samples;  // nullptr unless demultiplexing
+    bool inline_barcode;  // barcodes from B segments instead of the read1 comment
+    const pair_reservoir* reservoir;  // nullptr unless sampling exactly K pairs
+    const read_merger* merger;  // nullptr unless merging overlapping pairs
+    const kmer_screen* screen;  // nullptr unless screening against reference k-mers
+    double screen_fraction;  // of the k-mers of a pair in the screen that take it out
+    bool route_screened;  // format the pairs taken out instead of dropping them
+    reorder_key reorder;  // what the pairs of out1/out2 are ordered by within a batch
+    uint64_t seed;  // of the name hash used for sampling
+    level_controller* levels;  // nullptr unless the level follows --target-mbps
+    bool packed;  // write fqb blocks instead of gzip
+    bool zstd;  // write zstd frames instead of gzip
+#ifdef HAVE_ZSTD
+    const zstd_dictionary* dict;  // the zstd frames are compressed with
+#endif
+    bool decode;  // turn fqb inputs back into gzip fastq
+    bool checksums;  // CRC32 of the zstd texts too, gzip members carry one anyway
+
+    // the defaults of the filter tool's options
+    filter_config(): cutQ(30), level(4), add_comment(true), treat_umi(false), prefix(':'), max_n(-1), phred(33),
+        umis(nullptr), samples(nullptr), inline_barcode(false), reservoir(nullptr), merger(nullptr), screen(nullptr),
+        screen_fraction(0.25), route_screened(false), reorder(REORDER_NONE), seed(1), levels(nullptr),
+        packed(false), zstd(false),
+#ifdef HAVE_ZSTD
+        dict(nullptr),
+#endif
+        decode(false), checksums(false) {}
+};
+
+// per worker scratch space reused from batch to batch
+struct worker_scratch {
+    std::string UMISeq;
+    umi_stats umi;
+    std::string barcode;
+    std::vector<uint32_t> sample, first, sorted;
+    std::vector<std::pair<uint64_t, uint32_t>> keys;  // of the selected pairs, for --reorder
+    fqb_encoder packer[2];
+    fqb_decoder unpacker;
+    merged_read merged;
+#ifdef HAVE_ZSTD
+    zstd_compressor zstd;
+#endif
+};
+
+// sum of the quality characters in [start, start + length), psadbw adds
+// sixteen of them per instruction
+inline int quality_sum(const char* quality, int start, int length) {
+    const unsigned char* q = (const unsigned char*)quality + start;
+    int sumQ = 0, i = 0;
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128(), sum = zero;
+    for(; i + 16 <= length; i += 16)
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(q + i)), zero));
+    sumQ = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+#endif
+    for(; i < length; i++)
+        sumQ += q[i];
+    return sumQ;
+}
+
+// number of N bases in [start, start + length)
+inline int n_count(const char* seq, int start, int length) {
+    const char* s = seq + start;
+    int n = 0, i = 0;
+#ifdef __SSE2__
+    __m128i N = _mm_set1_epi8('N');
+    for(; i + 16 <= length; i += 16)
+        n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s + i)), N)));
+#endif
+    for(; i < length; i++)
+        n += s[i] == 'N';
+    return n;
+}
+
+template <int PHRED>
+int average_quality(const char* quality, int start, int length) {
+    return quality_sum(quality, start, length) / length - PHRED;
+}
+
+// the UMI segments of read1, then those of read2 behind the connector
+inline void get_umi(std::string& umi, const read_plan* plan, const char* sequence1, const char* sequence2,
+    char connect = '_') {
+    umi.clear();
+    append_segments(umi, plan[0].umi, sequence1);
+    if(!plan[0].umi.empty() && !plan[1].umi.empty())
+        umi += connect;
+    append_segments(umi, plan[1].umi, sequence2);
+}
+
+// appends one fastq record, sized up front so the text grows once per read
+template <bool UMI, bool COMMENT, bool BIN>
+void write_record(std::string& out, const char* name, size_t name_l, const char* comment_s, size_t comment_l,
+    char p, const std::string& umi, const char* seq, const char* qual, int length, const quality_bins& bins) {
+    bool comment = COMMENT && comment_l;
+    size_t n = out.size();
+    out.resize(n + name_l + (UMI? umi.size() + 1: 0) + (comment? comment_l + 1: 0) + 2 * length + 6);
+    char* s = &out[n];
+    *s++ = '@';
+    memcpy(s, name, name_l);
+    s += name_l;
+    if(UMI) {
+        *s++ = p;
+        memcpy(s, umi.data(), umi.size());
+        s += umi.size();
+    }
+    if(comment) {
+        *s++ = ' ';
+        memcpy(s, comment_s, comment_l);
+        s += comment_l;
+    }
+    *s++ = '\n';
+    memcpy(s, seq, length);
+    s += length;
+    memcpy(s, "\n+\n", 3);
+    s += 3;
+    if(BIN)
+        bins.apply(s, qual, length, bins);
+    else
+        memcpy(s, qual, length);
+    s[length] = '\n';
+}
+
+// the template [start, start + length) of a read of the batch as a record
+template <bool UMI, bool COMMENT, bool BIN>
+inline void write_read(std::string& out, const read_batch* b, size_t read,
+    char p, const std::string& umi, int start, int length, const quality_bins& bins) {
+    write_record<UMI, COMMENT, BIN>(out, b->name(read), b->name_l[read], b->comment(read), b->comment_l[read],
+                                    p, umi, b->seq(read) + start, b->qual(read) + start, length, bins);
+}
+
+// deflates text into out as one complete gzip member, members of successive
+// batches concatenate into a valid multi-member gzip file; returns the
+// CRC32 of text, which deflate takes for the member's trailer anyway
+uint32_t compress_block(z_stream* zs, const std::string& text, std::string& out);
+
+// the gzip members of out1 and out2 and the CRC32 of their texts, nothing
+// for an empty text
+void compress_texts(z_stream* zs, const std::string* text, std::string* out, uint32_t* crc);
+
+#ifdef HAVE_ZSTD
+// CRC32 of text with c.checksums, zstd does not take one on its own
+uint32_t text_crc(const filter_config& c, const std::string& text);
+
+// the zstd frames of out1 and out2, nothing for an empty text; false if
+// zstd failed on either
+bool zstd_texts(zstd_compressor& zc, const filter_config& c, const std::string* text, std::string* out, uint32_t* crc);
+
+// Trains the zstd dictionary on the reads of a batch as fastq, a sample each.
+// A batch is large enough for zstd to find most repeats of the names within
+// it, so the dictionary is only kept if it saves more than its own frame on
+// the batch it was trained on.
+bool train_dictionary(const read_batch* b, int level, zstd_dictionary& dict, std::string& error);
+#endif
+
+// fills b with the next pairs the limits take, false once either input or
+// the limits are exhausted; pairs sampled out are dropped here, before
+// being copied or scored
+bool fill_batch(kseq_t* reads1, kseq_t* reads2, read_limits& limits, read_batch* b);
+
+// batches of pairs into todo until the inputs or limits run out, then closes
+// it; with a trace, the time spent waiting for a free batch and reading each
+void read_pairs(kseq_t* reads1, kseq_t* reads2, read_limits& limits, batch_pool& pool, batch_queue& todo, uint64_t id,
+    trace_ring* trace = nullptr);
+
+// Builds the screen from the sequences of a fasta, plain or compressed, in
+// two passes: the first counts the k-mers it has to be sized for.
+bool build_screen(const std::string& path, int k, const io_options& io, kmer_screen& screen, std::string& error);
+
+// Phred offset guessed from the qualities of every read in the batch
+int batch_phred(const read_batch* b);
+
+// length of the template of read r, FIXED_LENGTH when both mates have one
+template <bool FIXED_LENGTH>
+inline int template_length(const read_batch* b, size_t r, const filter_config& c) {
+    const read_plan& p = c.plan[r & 1];
+    if(FIXED_LENGTH || p.template_length)
+        return p.template_length;
+    return b->seq_l[r] - p.template_start;
+}
+
+// Read level kernels, each a single pass over one column of the batch.
+// They clear pass[r] of the reads they reject, reads too short for their
+// structure included.
+template <bool FIXED_LENGTH, int PHRED>
+void score_qualities(read_batch* b, const filter_config& c) {
+    size_t n = b->reads();
+    b->pass.resize(n);
+    for(size_t r = 0; r < n; r++) {
+        const read_plan& p = c.plan[r & 1];
+        b->pass[r] = (int)b->seq_l[r] >= p.min_length &&
+                     average_quality<PHRED>(b->qual(r), p.template_start, template_length<FIXED_LENGTH>(b, r, c)) >= c.cutQ;
+    }
+}
+
+// only over reads still passing: one shorter than its structure has no
+// template_length bases to count
+template <bool FIXED_LENGTH>
+void count_ns(read_batch* b, const filter_config& c) {
+    size_t n = b->reads();
+    for(size_t r = 0; r < n; r++)
+        if(b->pass[r])
+            b->pass[r] = n_count(b->seq(r), c.plan[r & 1].template_start, template_length<FIXED_LENGTH>(b, r, c)) <= c.max_n;
+}
+
+// runs the kernels and compacts the pairs whose reads both pass into the
+// selection vector, without a branch per pair
+template <bool FIXED_LENGTH, int PHRED>
+void select_pairs(read_batch* b, const filter_config& c) {
+    score_qualities<FIXED_LENGTH, PHRED>(b, c);
+    if(c.max_n >= 0)
+        count_ns<FIXED_LENGTH>(b, c);
+    b->selected.resize(b->pairs);
+    size_t kept = 0;
+    for(size_t i = 0; i < b->pairs; i++) {
+        b->selected[kept] = i;
+        kept += b->pass[2 * i] & b->pass[2 * i + 1];
+    }
+    b->selected.resize(kept);
+}
+
+template <bool UMI, bool COMMENT, bool BIN>
+void pack_read(fqb_encoder& packer, const read_batch* b, size_t read,
+    const std::string& umi, int start, int length, const quality_bins& bins) {
+    char* qual = packer.add(b->name(read), b->name_l[read], umi.data(), UMI? umi.size(): 0,
+                            b->comment(read), COMMENT? b->comment_l[read]: 0, b->seq(read) + start, length);
+    if(BIN)
+        bins.apply(qual, b->qual(read) + start, length, bins);
+    else
+        memcpy(qual, b->qual(read) + start, length);
+}
+
+// Matches the barcode of every selected pair against the sample sheet, then
+// orders the selection by sample with a counting sort that keeps the input
+// order within each sample, so every sample is formatted as one run.
+void split_samples(read_batch* b, const filter_config& c, worker_scratch& w);
+
+// The per record loop, instantiated for every combination of the mode flags
+// so that none of them is tested per read. Formats selected pairs [from, to)
+// into text, or packs them into fqb blocks in out.
+template <bool UMI, bool COMMENT, bool BIN, bool FIXED_LENGTH, bool PACKED>
+void format_pairs(const read_batch* b, size_t from, size_t to, const filter_config& c, worker_scratch& w,
+    std::string* text, std::string* out) {
+    int seq1_end, seq2_end;
+    int seq1_start = c.plan[0].template_start, seq2_start = c.plan[1].template_start;
+    for(int i = 0; i < 2; i++) {
+        text[i].clear();
+        if(PACKED)
+            w.packer[i].begin(UMI? c.prefix: 0);
+    }
+    for(size_t s = from; s < to; s++) {
+        size_t read1 = 2 * b->selected[s], read2 = read1 + 1;
+        seq1_end = template_length<FIXED_LENGTH>(b, read1, c);
+        seq2_end = template_length<FIXED_LENGTH>(b, read2, c);
+        if(UMI) {
+            get_umi(w.UMISeq, c.plan, b->seq(read1), b->seq(read2));
+            if(c.umis)
+                c.umis->correct(w.UMISeq, w.umi);
+        }
+        if(PACKED) {
+            pack_read<UMI, COMMENT, BIN>(w.packer[0], b, read1, w.UMISeq, seq1_start, seq1_end, c.bins);
+            pack_read<UMI, COMMENT, BIN>(w.packer[1], b, read2, w.UMISeq, seq2_start, seq2_end, c.bins);
+        } else {
+            write_read<UMI, COMMENT, BIN>(text[0], b, read1, c.prefix, w.UMISeq, seq1_start, seq1_end, c.bins);
+            write_read<UMI, COMMENT, BIN>(text[1], b, read2, c.prefix, w.UMISeq, seq2_start, seq2_end, c.bins);
+        }
+    }
+    if(PACKED)
+        for(int i = 0; i < 2; i++) {
+            if(w.packer[i].records())
+                w.packer[i].finish(out[i], c.level);
+            else
+                out[i].clear();
+        }
+}
+
+// Takes the selected pairs out that have at least c.screen_fraction of the
+// k-mers of both templates in the screen. With c.route_screened they are
+// formatted into b->screened, otherwise only counted there.
+template <bool UMI, bool COMMENT, bool BIN, bool FIXED_LENGTH>
+void screen_pairs(read_batch* b, const filter_config& c, worker_scratch& w) {
+    int start1 = c.plan[0].template_start, start2 = c.plan[1].template_start;
+    std::vector<uint32_t>& hits = w.sorted;
+    hits.clear();
+    size_t kept = 0;
+    for(size_t s = 0; s < b->selected.size(); s++) {
+        size_t read1 = 2 * b->selected[s], read2 = read1 + 1;
+        int kmers = 0, found = 0;
+        c.screen->count(b->seq(read1) + start1, template_length<FIXED_LENGTH>(b, read1, c), kmers, found);
+        c.screen->count(b->seq(read2) + start2, template_length<FIXED_LENGTH>(b, read2, c), kmers, found);
+        if(kmers && found >= c.screen_fraction * kmers)
+            hits.push_back(b->selected[s]);
+        else
+            b->selected[kept++] = b->selected[s];
+    }
+    b->screened.pairs = hits.size();
+    b->selected.resize(kept);
+    if(c.route_screened) {
+        b->selected.insert(b->selected.end(), hits.begin(), hits.end());
+        format_pairs<UMI, COMMENT, BIN, FIXED_LENGTH, false>(b, kept, b->selected.size(), c, w, b->screened.text,
+                                                             b->screened.out);
+        b->selected.resize(kept);
+    }
+}
+
+// Merges the selected pairs whose reads overlap into one read each, named
+// after read1, and takes them out of the selection so that only the others
+// are formatted as pairs.
+template <bool UMI, bool COMMENT, bool BIN, bool FIXED_LENGTH>
+void merge_pairs(read_batch* b, const filter_config& c, worker_scratch& w) {
+    int start1 = c.plan[0].template_start, start2 = c.plan[1].template_start;
+    merged_read& m = w.merged;
+    b->merged_text.clear();
+    size_t kept = 0;
+    for(size_t s = 0; s < b->selected.size(); s++) {
+        size_t read1 = 2 * b->selected[s], read2 = read1 + 1;
+        b->selected[kept] = b->selected[s];
+        if(!c.merger->merge(b->seq(read1) + start1, b->qual(read1) + start1, template_length<FIXED_LENGTH>(b, read1, c),
+                            b->seq(read2) + start2, b->qual(read2) + start2, template_length<FIXED_LENGTH>(b, read2, c),
+                            c.phred, m)) {
+            kept++;
+            continue;
+        }
+        if(UMI) {
+            get_umi(w.UMISeq, c.plan, b->seq(read1), b->seq(read2));
+            if(c.umis)
+                c.umis->correct(w.UMISeq, w.umi);
+        }
+        write_record<UMI, COMMENT, BIN>(b->merged_text, b->name(read1), b->name_l[read1], b->comment(read1),
+                                        b->comment_l[read1], c.prefix, w.UMISeq, m.seq.data(), m.qual.data(),
+                                        m.seq.size(), c.bins);
+        b->merged_pairs++;
+    }
+    b->selected.resize(kept);
+}
+
+// Orders the selected pairs by the key of c.reorder: the minimizer of the
+// read1 template, or the hash of the UMI. Pairs of one key keep their input
+// order, and read1 and read2 stay in step as both are formatted from the
+// one selection. The batch bounds what is reordered, and its memory.
+template <bool UMI, bool FIXED_LENGTH>
+void reorder_pairs(read_batch* b, const filter_config& c, worker_scratch& w) {
+    size_t n = b->selected.size();
+    w.keys.resize(n);
+    for(size_t s = 0; s < n; s++) {
+        size_t read1 = 2 * b->selected[s];
+        uint64_t key;
+        if(UMI && c.reorder == REORDER_UMI) {
+            get_umi(w.UMISeq, c.plan, b->seq(read1), b->seq(read1 + 1));
+            key = name_hash(w.UMISeq.data(), w.UMISeq.size(), 0);
+        } else {
+            key = minimizer(b->seq(read1) + c.plan[0].template_start, template_length<FIXED_LENGTH>(b, read1, c),
+                            MINIMIZER_K);
+        }
+        w.keys[s] = std::make_pair(key, b->selected[s]);
+    }
+    std::sort(w.keys.begin(), w.keys.end());
+    for(size_t s = 0; s < n; s++)
+        b->selected[s] = w.keys[s].second;
+}
+
+// drops the selected pairs that can not get into the reservoir any more and
+// keeps the name hashes of the others
+void prune_to_reservoir(read_batch* b, const filter_config& c);
+
+// The pair hook of the filter tool, which keeps every pair the built-in
+// filters pass. A program embedding the library passes its own: a functor
+// called as hook(batch, pair) on every pair the built-in filters keep,
+// inlined into the filter loop. It may rewrite the bases and qualities of
+// reads 2 * pair and 2 * pair + 1 in place, and returns false to drop them.
+struct keep_pairs {
+    bool operator()(read_batch&, size_t) const { return true; }
+};
+
+// keeps the selected pairs the hook keeps
+template <class HOOK>
+void hook_pairs(read_batch* b, HOOK& hook) {
+    size_t kept = 0;
+    for(size_t s = 0; s < b->selected.size(); s++) {
+        b->selected[kept] = b->selected[s];
+        kept += hook(*b, b->selected[s]);
+    }
+    b->selected.resize(kept);
+}
+
+template <class HOOK, bool UMI, bool COMMENT, bool BIN, bool FIXED_LENGTH, bool PACKED, int PHRED>
+void filter_batch(read_batch* b, const filter_config& c, worker_scratch& w, HOOK& hook) {
+    select_pairs<FIXED_LENGTH, PHRED>(b, c);
+    if(!std::is_same<HOOK, keep_pairs>::value)
+        hook_pairs(b, hook);
+    if(c.screen)
+        screen_pairs<UMI, COMMENT, BIN, FIXED_LENGTH>(b, c, w);
+    if(c.merger)
+        merge_pairs<UMI, COMMENT, BIN, FIXED_LENGTH>(b, c, w);
+    if(c.reservoir)
+        prune_to_reservoir(b, c);
+    if(c.reorder)
+        reorder_pairs<UMI, FIXED_LENGTH>(b, c, w);
+    if(!c.samples) {
+        format_pairs<UMI, COMMENT, BIN, FIXED_LENGTH, PACKED>(b, 0, b->selected.size(), c, w, b->text, b->out);
+        return;
+    }
+    split_samples(b, c, w);
+    for(size_t k = 0, from = 0; k < b->samples.size(); from += b->samples[k].pairs, k++) {
+        sample_output& o = b->samples[k];
+        format_pairs<UMI, COMMENT, BIN, FIXED_LENGTH, PACKED>(b, from, from + o.pairs, c, w, o.text, o.out);
+    }
+}
+
+template <class HOOK>
+using batch_filter = void (*)(read_batch*, const filter_config&, worker_scratch&, HOOK&);
+
+template <class HOOK, bool UMI, bool COMMENT, bool BIN, bool FIXED_LENGTH, bool PACKED>
+batch_filter<HOOK> select_filter(const filter_config& c) {
+    return c.phred == 64? filter_batch<HOOK, UMI, COMMENT, BIN, FIXED_LENGTH, PACKED, 64>:
+                          filter_batch<HOOK, UMI, COMMENT, BIN, FIXED_LENGTH, PACKED, 33>;
+}
+
+template <class HOOK, bool UMI, bool COMMENT, bool BIN, bool FIXED_LENGTH>
+batch_filter<HOOK> select_filter(const filter_config& c) {
+    return c.packed? select_filter<HOOK, UMI, COMMENT, BIN, FIXED_LENGTH, true>(c):
+                     select_filter<HOOK, UMI, COMMENT, BIN, FIXED_LENGTH, false>(c);
+}
+
+template <class HOOK, bool UMI, bool COMMENT, bool BIN>
+batch_filter<HOOK> select_filter(const filter_config& c) {
+    return c.plan[0].template_length && c.plan[1].template_length? select_filter<HOOK, UMI, COMMENT, BIN, true>(c):
+                                                                    select_filter<HOOK, UMI, COMMENT, BIN, false>(c);
+}
+
+template <class HOOK, bool UMI, bool COMMENT>
+batch_filter<HOOK> select_filter(const filter_config& c) {
+    return c.bins.levels? select_filter<HOOK, UMI, COMMENT, true>(c): select_filter<HOOK, UMI, COMMENT, false>(c);
+}
+
+template <class HOOK, bool UMI>
+batch_filter<HOOK> select_filter(const filter_config& c) {
+    return c.add_comment? select_filter<HOOK, UMI, true>(c): select_filter<HOOK, UMI, false>(c);
+}
+
+// picks the instantiation of filter_batch matching the options, once per run
+template <class HOOK>
+batch_filter<HOOK> select_filter(const filter_config& c) {
+    return c.treat_umi? select_filter<HOOK, true>(c): select_filter<HOOK, false>(c);
+}
+
+// the filter tool's instantiations are compiled once, into the library
+extern template batch_filter<keep_pairs> select_filter<keep_pairs>(const filter_config& c);
+
+// compresses the text of a filtered batch, merged and routed screened pairs
+// included, into out: gzip members with zs, or zstd frames; fqb blocks were
+// packed by the filter already. Returns false if zstd failed on any text,
+// deflating into a buffer of deflateBound can not fail.
+bool compress_batch(read_batch* b, const filter_config& c, worker_scratch& w, z_stream* zs);
+
+// out1 and out2 of one sample, or of every pair without demultiplexing
+struct output_files {
+    async_writer out[2];
+    fqb_index index[2];  // written out for fqb output only
+    async_writer merged;  // pairs merged into one read, of files[0] only
+    async_writer screened[2];  // pairs hitting the screen, of files[0] only
+    uint64_t pairs, merged_pairs, screened_pairs;
+    stream_crc crc[2], merged_crc, screened_crc[2];  // of the fastq before compression
+
+    output_files(): pairs(0), merged_pairs(0), screened_pairs(0) {}
+
+    // the compressed data of text, whose CRC32 is crc
+    void write(const std::string* data, uint32_t records, const std::string* text, const uint32_t* crc) {
+        for(int i = 0; i < 2; i++) {
+            out[i].write(data[i].data(), data[i].size());
+            index[i].add(data[i].size(), records);
+            this->crc[i].add(crc[i], text[i].size());
+        }
+        pairs += records;
+    }
+};
+
+void write_batch(std::vector<output_files>& files, const read_batch* b);
+
+// a gzip output without any passing read still has to be a valid gzip file,
+// fqb files end with their block index
+bool close_file(async_writer& f, int level, bool gzip, const fqb_index* index);
+
+// In-process filtering of batches: fill a read_batch with fill_batch, or
+// with add_pair on kstring_t views of records already in memory until it is
+// full(), then
+// filter() leaves the fastq of the pairs kept in text (per sample in
+// samples) and compress() the gzip or zstd blocks of it in out, as the
+// filter tool would write them. One per thread; batches are independent.
+template <class HOOK = keep_pairs>
+class fastq_filter {
+public:
+    explicit fastq_filter(const filter_config& c, HOOK hook = HOOK()):
+        c_(c), hook_(hook), filter_(select_filter<HOOK>(c)) {
+        memset(&zs_, 0, sizeof(zs_));
+        deflateInit2(&zs_, c.level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    }
+    ~fastq_filter() { deflateEnd(&zs_); }
+
+    void filter(read_batch* b) { filter_(b, c_, w_, hook_); }
+    bool compress(read_batch* b) { return compress_batch(b, c_, w_, &zs_); }
+
+    HOOK& hook() { return hook_; }
+    // UMIs corrected so far, with c.umis
+    const umi_stats& umi() const { return w_.umi; }
+
+private:
+    fastq_filter(const fastq_filter&);
+    fastq_filter& operator=(const fastq_filter&);
+
+    filter_config c_;
+    HOOK hook_;
+    batch_filter<HOOK> filter_;
+    worker_scratch w_;
+    z_stream zs_;
+};
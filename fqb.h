@@ -0,0 +1,303 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+// FQB, a column-blocked binary container for filtered reads, one file per mate.
+//
+//   file   := "FQB\1" block* index
+//   block  := "FQBK" u32 size | u32 records u8 prefix u8 columns
+//             (u8 codec u32 raw u32 stored)[columns] column data...
+//   index  := "FQBI" u64 blocks (u64 offset u32 records)[blocks] u64 index_offset "FQBE"
+//
+// size counts the bytes after itself, integers are little endian. The columns
+// of a block are the per record lengths (varints of name, umi, comment and
+// sequence length), names, UMIs, comments, 2-bit packed bases, the exceptions
+// of the 2-bit code (varint distance from the previous one plus the base) and
+// qualities. Names are stored without their UMI, which is put back behind
+// the prefix character when decoding.
+
+const char FQB_MAGIC[4] = {'F', 'Q', 'B', 1};
+enum fqb_column { FQB_LENGTHS, FQB_NAMES, FQB_UMIS, FQB_COMMENTS, FQB_BASES, FQB_EXCEPTIONS, FQB_QUALS, FQB_COLUMNS };
+enum fqb_codec { FQB_RAW, FQB_DEFLATE };
+
+inline void put_u32(std::string& out, uint32_t v) {
+    for(int i = 0; i < 4; i++) out += (char)(v >> (8 * i));
+}
+
+inline void put_u64(std::string& out, uint64_t v) {
+    for(int i = 0; i < 8; i++) out += (char)(v >> (8 * i));
+}
+
+inline uint64_t get_uint(const char* p, int bytes) {
+    uint64_t v = 0;
+    for(int i = 0; i < bytes; i++) v |= (uint64_t)(unsigned char)p[i] << (8 * i);
+    return v;
+}
+
+inline void put_varint(std::string& out, uint64_t v) {
+    while(v >= 0x80) {
+        out += (char)(v | 0x80);
+        v >>= 7;
+    }
+    out += (char)v;
+}
+
+// false when the varint runs past end
+inline bool get_varint(const char*& p, const char* end, uint64_t& v) {
+    v = 0;
+    for(int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char c = *p++;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if(!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+// 2-bit code of A, C, G and T, 4 for everything that goes to the exceptions;
+// a table rather than a switch, which mispredicts on every base. k-mer
+// hashing folds case, the fqb code keeps lowercase bases as exceptions.
+struct base_code {
+    unsigned char code[256];
+    explicit base_code(bool fold_case = false) {
+        memset(code, 4, sizeof(code));
+        code['A'] = 0; code['C'] = 1; code['G'] = 2; code['T'] = 3;
+        if(fold_case) {
+            code['a'] = 0; code['c'] = 1; code['g'] = 2; code['t'] = 3;
+        }
+    }
+};
+
+// Builds the columns of one block, reusing its buffers from block to block.
+class fqb_encoder {
+public:
+    fqb_encoder(): prefix_(0), records_(0), bases_(0), last_exception_(0) {
+        memset(&zs_, 0, sizeof(zs_));
+        deflateInit2(&zs_, 4, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    }
+    ~fqb_encoder() { deflateEnd(&zs_); }
+
+    void begin(char prefix) {
+        prefix_ = prefix;
+        records_ = bases_ = last_exception_ = 0;
+        for(int i = 0; i < FQB_COLUMNS; i++) columns_[i].clear();
+    }
+
+    // adds one read and returns where its length qualities go
+    char* add(const char* name, size_t name_l, const char* umi, size_t umi_l,
+              const char* comment, size_t comment_l, const char* seq, size_t length) {
+        static const base_code bases;
+        put_varint(columns_[FQB_LENGTHS], name_l);
+        put_varint(columns_[FQB_LENGTHS], umi_l);
+        put_varint(columns_[FQB_LENGTHS], comment_l);
+        put_varint(columns_[FQB_LENGTHS], length);
+        columns_[FQB_NAMES].append(name, name_l);
+        columns_[FQB_UMIS].append(umi, umi_l);
+        columns_[FQB_COMMENTS].append(comment, comment_l);
+        std::string& packed = columns_[FQB_BASES];
+        packed.resize((bases_ + length + 3) / 4, '\0');
+        for(size_t i = 0; i < length; i++, bases_++) {
+            unsigned char code = bases.code[(unsigned char)seq[i]];
+            if(code > 3) {
+                put_varint(columns_[FQB_EXCEPTIONS], bases_ - last_exception_);
+                columns_[FQB_EXCEPTIONS] += seq[i];
+                last_exception_ = bases_;
+                code = 0;
+            }
+            packed[bases_ >> 2] |= code << (2 * (bases_ & 3));
+        }
+        records_++;
+        std::string& quals = columns_[FQB_QUALS];
+        quals.resize(quals.size() + length);
+        return &quals[quals.size() - length];
+    }
+
+    size_t records() const { return records_; }
+
+    // writes the block; the bases are left raw since 2-bit codes hardly deflate
+    void finish(std::string& out, int level) {
+        deflateParams(&zs_, level, Z_DEFAULT_STRATEGY);
+        out.assign("FQBK", 4);
+        put_u32(out, 0);
+        put_u32(out, records_);
+        out += prefix_;
+        out += (char)FQB_COLUMNS;
+        size_t descriptors = out.size();
+        out.resize(descriptors + 9 * FQB_COLUMNS);
+        for(int i = 0; i < FQB_COLUMNS; i++) {
+            const std::string& column = columns_[i];
+            size_t start = out.size();
+            int codec = i == FQB_BASES || column.empty()? FQB_RAW: FQB_DEFLATE;
+            if(codec == FQB_DEFLATE) {
+                deflateReset(&zs_);
+                out.resize(start + deflateBound(&zs_, column.size()));
+                zs_.next_in = (Bytef*)column.data();
+                zs_.avail_in = column.size();
+                zs_.next_out = (Bytef*)&out[start];
+                zs_.avail_out = out.size() - start;
+                deflate(&zs_, Z_FINISH);
+                out.resize(start + zs_.total_out);
+            } else {
+                out += column;
+            }
+            std::string d;
+            d += (char)codec;
+            put_u32(d, column.size());
+            put_u32(d, out.size() - start);
+            memcpy(&out[descriptors + 9 * i], d.data(), 9);
+        }
+        std::string size;
+        put_u32(size, out.size() - 8);
+        memcpy(&out[4], size.data(), 4);
+    }
+
+private:
+    z_stream zs_;
+    std::string columns_[FQB_COLUMNS];
+    char prefix_;
+    size_t records_;
+    uint64_t bases_, last_exception_;
+};
+
+// Expands one block (as written by fqb_encoder::finish) back to fastq text.
+class fqb_decoder {
+public:
+    fqb_decoder() {
+        memset(&zs_, 0, sizeof(zs_));
+        inflateInit2(&zs_, -15);
+    }
+    ~fqb_decoder() { inflateEnd(&zs_); }
+
+    // appends the records to text, false if the block is damaged
+    bool decode(const std::string& block, std::string& text, uint32_t* records = nullptr) {
+        static const char letters[4] = {'A', 'C', 'G', 'T'};
+        if(block.size() < 14 || block.compare(0, 4, "FQBK") || get_uint(&block[4], 4) != block.size() - 8)
+            return false;
+        uint32_t n = get_uint(&block[8], 4);
+        char prefix = block[12];
+        if((unsigned char)block[13] != FQB_COLUMNS || block.size() < 14 + 9 * FQB_COLUMNS)
+            return false;
+        size_t offset = 14 + 9 * FQB_COLUMNS;
+        for(int i = 0; i < FQB_COLUMNS; i++) {
+            const char* d = &block[14 + 9 * i];
+            size_t raw = get_uint(d + 1, 4), stored = get_uint(d + 5, 4);
+            if(offset + stored > block.size() || !expand(d[0], &block[offset], stored, raw, columns_[i]))
+                return false;
+            offset += stored;
+        }
+        const char* lengths = columns_[FQB_LENGTHS].data();
+        const char* lengths_end = lengths + columns_[FQB_LENGTHS].size();
+        const char* exceptions = columns_[FQB_EXCEPTIONS].data();
+        const char* exceptions_end = exceptions + columns_[FQB_EXCEPTIONS].size();
+        const char* name = columns_[FQB_NAMES].data();
+        const char* umi = columns_[FQB_UMIS].data();
+        const char* comment = columns_[FQB_COMMENTS].data();
+        const char* qual = columns_[FQB_QUALS].data();
+        const unsigned char* packed = (const unsigned char*)columns_[FQB_BASES].data();
+        uint64_t base = 0, next_exception = 0, delta = 0;
+        bool has_exception = exceptions < exceptions_end && get_varint(exceptions, exceptions_end, next_exception);
+        size_t total_names = 0, total_umis = 0, total_comments = 0, total_bases = 0;
+        for(uint32_t r = 0; r < n; r++) {
+            uint64_t name_l, umi_l, comment_l, length;
+            if(!get_varint(lengths, lengths_end, name_l) || !get_varint(lengths, lengths_end, umi_l) ||
+               !get_varint(lengths, lengths_end, comment_l) || !get_varint(lengths, lengths_end, length))
+                return false;
+            total_names += name_l;
+            total_umis += umi_l;
+            total_comments += comment_l;
+            total_bases += length;
+            if(total_names > columns_[FQB_NAMES].size() || total_umis > columns_[FQB_UMIS].size() ||
+               total_comments > columns_[FQB_COMMENTS].size() || total_bases > columns_[FQB_QUALS].size() ||
+               (total_bases + 3) / 4 > columns_[FQB_BASES].size())
+                return false;
+            text += '@';
+            text.append(name, name_l);
+            name += name_l;
+            if(umi_l) {
+                text += prefix;
+                text.append(umi, umi_l);
+                umi += umi_l;
+            }
+            if(comment_l) {
+                text += ' ';
+                text.append(comment, comment_l);
+                comment += comment_l;
+            }
+            text += '\n';
+            size_t start = text.size();
+            text.resize(start + length);
+            char* s = &text[start];
+            for(uint64_t i = 0; i < length; i++, base++) {
+                if(has_exception && base == next_exception) {
+                    if(exceptions >= exceptions_end)
+                        return false;
+                    s[i] = *exceptions++;
+                    has_exception = exceptions < exceptions_end && get_varint(exceptions, exceptions_end, delta);
+                    next_exception += delta;
+                } else {
+                    s[i] = letters[(packed[base >> 2] >> (2 * (base & 3))) & 3];
+                }
+            }
+            text += "\n+\n";
+            text.append(qual, length);
+            qual += length;
+            text += '\n';
+        }
+        if(records) *records = n;
+        return true;
+    }
+
+private:
+    bool expand(int codec, const char* data, size_t stored, size_t raw, std::string& column) {
+        if(codec == FQB_RAW) {
+            if(stored != raw) return false;
+            column.assign(data, stored);
+            return true;
+        }
+        if(codec != FQB_DEFLATE) return false;
+        column.resize(raw);
+        inflateReset(&zs_);
+        zs_.next_in = (Bytef*)data;
+        zs_.avail_in = stored;
+        zs_.next_out = (Bytef*)&column[0];
+        zs_.avail_out = raw;
+        return inflate(&zs_, Z_FINISH) == Z_STREAM_END && zs_.avail_out == 0;
+    }
+
+    z_stream zs_;
+    std::string columns_[FQB_COLUMNS];
+};
+
+// Offsets of the blocks written so far, appended at the end of the file so a
+// reader can seek to any block and decode blocks in parallel.
+class fqb_index {
+public:
+    fqb_index(): offset_(sizeof(FQB_MAGIC)) {}
+
+    void add(size_t bytes, uint32_t records) {
+        if(!bytes) return;
+        offsets_.push_back(offset_);
+        records_.push_back(records);
+        offset_ += bytes;
+    }
+
+    std::string trailer() const {
+        std::string out("FQBI", 4);
+        put_u64(out, offsets_.size());
+        for(size_t i = 0; i < offsets_.size(); i++) {
+            put_u64(out, offsets_[i]);
+            put_u32(out, records_[i]);
+        }
+        put_u64(out, offset_);
+        out.append("FQBE", 4);
+        return out;
+    }
+
+private:
+    uint64_t offset_;
+    std::vector<uint64_t> offsets_;
+    std::vector<uint32_t> records_;
+};
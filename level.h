@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+
+// Picks the deflate level of every block so that the workers keep up with a
+// target rate of fastq text, as high a level as that allows within
+// [min, max]. Workers report each block: its filter and deflate time and the
+// reader's backlog when it was done. From these the controller keeps a
+// filter cost per byte and a deflate speed per level, and projects the rate
+// all workers reach at a level. It steps down a level when the projection
+// misses the target, and up when the next level's projection (or, not
+// knowing it yet, 25% headroom at this one) still meets the target and the
+// workers are not behind the reader. A level is held for a few blocks
+// after every change so the estimates catch up.
+class level_controller {
+public:
+    level_controller(int min_level, int max_level, int start, double target_mbps, int workers):
+        min_(min_level), max_(max_level), target_(target_mbps * 1e6), workers_(workers), filter_cost_(0),
+        since_change_(0), backlog_blocks_(0), level_(start) {
+        for(int l = 0; l < LEVELS; l++) {
+            speed_[l] = 0;
+            blocks_[l] = in_[l] = out_[l] = 0;
+        }
+    }
+
+    int level() const { return level_.load(std::memory_order_relaxed); }
+
+    // a block of in bytes filtered in filter_seconds and deflated to out bytes
+    // at level in deflate_seconds, with backlog batches waiting for a worker
+    void report(int level, uint64_t in, uint64_t out, double filter_seconds, double deflate_seconds, size_t backlog) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blocks_[level]++;
+        in_[level] += in;
+        out_[level] += out;
+        bool behind = backlog >= (size_t)workers_;
+        backlog_blocks_ += behind;
+        if(!in || deflate_seconds <= 0)
+            return;
+        speed_[level] = average(speed_[level], in / deflate_seconds);
+        filter_cost_ = average(filter_cost_, filter_seconds / in);
+        if(level != level_ || ++since_change_ < HOLD_BLOCKS)
+            return;
+        int next = level;
+        if(projected(level) < target_ && level > min_)
+            next = level - 1;
+        else if(!behind && level < max_ &&
+                (speed_[level + 1]? projected(level + 1) >= target_: projected(level) >= 1.25 * target_))
+            next = level + 1;
+        if(next != level) {
+            level_.store(next, std::memory_order_relaxed);
+            since_change_ = 0;
+        }
+    }
+
+    // blocks, bytes and ratio per level, and the overall ratio
+    // formatted apart so that out keeps its own precision
+    void summary(std::ostream& log) const {
+        std::ostringstream out;
+        uint64_t in = 0, compressed = 0, blocks = 0;
+        out << std::fixed << std::setprecision(2) << "levels:";
+        for(int l = 0; l < LEVELS; l++) {
+            if(!blocks_[l]) continue;
+            out << (blocks? ", ": " ") << l << " x " << blocks_[l] << " blocks (ratio " << ratio(in_[l], out_[l]) << ")";
+            in += in_[l];
+            compressed += out_[l];
+            blocks += blocks_[l];
+        }
+        out << "\ncompression: " << in / 1e6 << " MB to " << compressed / 1e6 << " MB, ratio " << ratio(in, compressed)
+            << ", workers behind the reader for " << backlog_blocks_ << " of " << blocks << " blocks" << std::endl;
+        log << out.str();
+    }
+
+private:
+    static const int LEVELS = 10;
+    static const int HOLD_BLOCKS = 4;
+
+    static double average(double old, double sample) { return old? 0.75 * old + 0.25 * sample: sample; }
+    static double ratio(uint64_t in, uint64_t out) { return out? (double)in / out: 0; }
+
+    // bytes per second all workers filter and deflate at level
+    double projected(int level) const { return workers_ / (filter_cost_ + 1 / speed_[level]); }
+
+    int min_, max_;
+    double target_;  // bytes per second
+    int workers_;
+    double speed_[LEVELS];  // deflate bytes per second of one worker
+    double filter_cost_;    // filter seconds per byte of output text
+    int since_change_;
+    uint64_t blocks_[LEVELS], in_[LEVELS], out_[LEVELS];
+    uint64_t backlog_blocks_;
+    std::mutex mutex_;
+    std::atomic<int> level_;
+};
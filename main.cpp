@@ -1,139 +1,1077 @@
 #include <iostream>
 #include <fstream>
-#include <zlib.h>
+#include <iomanip>
+#include <map>
 #include <string>
-#include "kseq.h"
 #include "cmdline.h"
-KSEQ_INIT(gzFile, gzread)
+#include "affinity.h"
+#include "probe.h"
+#include "fastqfilter.h"
+#include "pool.h"
+#include "serve.h"
 
-cmdline::parser parameter(int argc, char *argv[]) {
-    cmdline::parser opt;
-    opt.add<std::string>("read1", '1', "Required, input read1, it can be compressed or not.", true);
-    opt.add<std::string>("read2", '2', "Required, input read2.", true);
-    opt.add<std::string>("out1", '3', "Required, out read1, compressed.", true);
-    opt.add<std::string>("out2", '4', "Required, out read2.", true);
+void add_options(cmdline::parser& opt) {
+    opt.add<std::string>("read1", '1', "Required, input read1, it can be compressed or not.", false);
+    opt.add<std::string>("read2", '2', "Required, input read2.", false);
+    opt.add<std::string>("out1", '3', "Required, out read1, compressed. With --samples {sample} in it is replaced by the sample name.", false);
+    opt.add<std::string>("out2", '4', "Required, out read2.", false);
+    opt.add<std::string>("merged", '5', "merge pairs whose reads overlap into one read written here, in the format of out1/out2.", false);
+    opt.add<int>("merge-overlap", '\0', "bases read1 and read2 overlap by at least to be merged, default is 15.", false, 15);
+    opt.add<int>("merge-mismatch", '\0', "percent of the overlap that may differ, default is 10.", false, 10);
+    opt.add<std::string>("screen", '\0', "fasta of contaminant sequences like PhiX, host or rRNA, or a filter saved from one "
+            "with --screen-save; pairs with --screen-fraction of their k-mers in it are dropped.", false);
+    opt.add<int>("screen-k", '\0', "k-mer length of the filter built from --screen, at most 32, default is 31.", false, 31);
+    opt.add<double>("screen-fraction", '\0', "fraction of the k-mers of a pair found in --screen that drops it, default is 0.25.",
+            false, 0.25);
+    opt.add<std::string>("screen-save", '\0', "save the filter built from --screen here, to be mapped by later runs.", false);
+    opt.add<std::string>("screened1", '\0', "write read1 of the pairs --screen drops here instead, in the format of out1.", false);
+    opt.add<std::string>("screened2", '\0', "write read2 of the pairs --screen drops here.", false);
+    opt.add("probe", '\0', "print the read length, quality encoding, pairing and UMI layout the first pairs of read1/read2 show, "
+            "with options that fit them, and exit.");
     opt.add<int>("qual", 'q', "mean quality threshold for discard reads, default is 30.", false, 30);
     opt.add("umi", '\0', "extract UMI sequence, default is NO.");
     opt.add<int>("umiStart", '\0', "start position(0 based) of UMI sequence, required for UMI.", false);
     opt.add<int>("umiLength", '\0', "UMI sequence length at one single read, required for UMI.", false);
     opt.add<std::string>("connection", '\0', "the character between readsID and UMI, it can be space(S), colon(C), or underline(U), default is space",
                  false, "C", cmdline::oneof<std::string>("S", "C", "U"));
+    opt.add<std::string>("umiWhitelist", '\0', "file of known UMIs, one per line, each UMI is corrected to the one within a mismatch.", false);
+    opt.add("umiCluster", '\0', "correct UMIs by directional clustering on their abundance, reads the inputs twice.");
+    opt.add<int>("umiMaxDistinct", '\0', "distinct UMIs counted for --umiCluster, rarer ones beyond it stay as they are, default is 16777216.",
+                 false, 1 << 24);
+    opt.add<std::string>("samples", '\0', "sample sheet to demultiplex by, lines of a sample name and its barcode, "
+                 "which is read from the B segments of the read structures or else the index in read1's comment.", false);
+    opt.add<int>("barcode-mismatches", '\0', "mismatches allowed in a barcode, 0 or 1, default is 1.", false, 1, cmdline::oneof<int>(0, 1));
     opt.add("disComment", '\0', "for disable reads's comment, default is NO.");
     opt.add<int>("readStart", '\0', "start position of real sequence, required for UMI.", false);
     opt.add<int>("readLength", '\0', "real sequence length, it can be ignored when the sequence reach the end", false);
-    opt.add<int>("level", '\0', "compression level for gzip output (1 ~ 9). 1 is fastest, 9 is smallest, default is 4.", false, 4);
+    opt.add<std::string>("structure1", '\0', "read structure of read1 like 8M12S+T, segments of T template, M UMI, B barcode or S skip, "
+                 "replaces --umiStart/--umiLength/--readStart/--readLength, default is +T.", false);
+    opt.add<std::string>("structure2", '\0', "read structure of read2, default is +T.", false);
+    opt.add<int>("level", '\0', "compression level for gzip output (1 ~ 9) or zst output (1 ~ 19). 1 is fastest, default is 4.", false, 4);
+    opt.add<double>("target-mbps", '\0', "adapt the gzip level per block so that the workers write this many MB/s of fastq, "
+                 "starting at --level.", false);
+    opt.add<int>("min-level", '\0', "lowest level --target-mbps may choose, default is 1.", false, 1);
+    opt.add<int>("max-level", '\0', "highest level --target-mbps may choose, default is 9.", false, 9);
+    opt.add<int>("maxN", '\0', "discard pairs with more N bases than this in either read, default is -1 for no limit.", false, -1);
+    opt.add<std::string>("phred", '\0', "quality encoding of the input, 33, 64 or auto to detect it from the first reads, default is auto.",
+                 false, "auto", cmdline::oneof<std::string>("auto", "33", "64"));
+    opt.add<int>("qbin", '\0', "bin output qualities into 8 or 4 Illumina style levels, 0 keeps them, default is 0.",
+                 false, 0, cmdline::oneof<int>(0, 4, 8));
+    opt.add<std::string>("format", '\0', "output format, gz for gzip fastq, fqb for the column-blocked binary format "
+                 "or zst for zstd fastq (a make ZSTD=1 build), default is gz.",
+                 false, "gz", cmdline::oneof<std::string>("gz", "fqb", "zst"));
+    opt.add<std::string>("zstd-dict", '\0', "zstd dictionary to compress zst output with, default is one trained on the first pairs.",
+                 false);
+    opt.add("decode", '\0', "convert fqb files given as read1/read2 back to gzip fastq out1/out2.");
+    opt.add<std::string>("manifest", '\0', "write the records, fastq size and CRC32, and size and md5 of every output here, "
+                 "taken while writing them.", false);
+    opt.add<std::string>("trace", '\0', "write a Chrome trace of every batch through the reader, workers and writer, "
+                 "with the queue depths, here; the last 65536 events of each thread are kept.", false);
+    opt.add("unordered", '\0', "write pairs in the order workers finish them instead of the input order, default is NO.");
+    opt.add<std::string>("reorder", '\0', "order the pairs of out1/out2 within every batch by the minimizer of read1 or by "
+                 "their UMI, so that similar reads compress together, default is none.",
+                 false, "none", cmdline::oneof<std::string>("none", "minimizer", "umi"));
+    opt.add<double>("sample-fraction", '\0', "keep this fraction of the pairs, chosen by a hash of the read name, default is 1.", false, 1);
+    opt.add<long long>("max-pairs", '\0', "stop reading after this many pairs, counted after --sample-fraction.", false);
+    opt.add<long long>("reservoir", '\0', "write exactly this many pairs drawn uniformly from those passing the filters, "
+                 "gzip output only.", false);
+    opt.add<int>("seed", '\0', "seed of the read name hash for --sample-fraction and --reservoir, default is 1.", false, 1);
+    opt.add<int>("thread", 't', "worker threads for filtering and compression, default is 4.", false, 4);
+    opt.add<std::string>("cpus", '\0', "cpu list to pin the reader, writer and workers to, like 0-7,16-23.", false);
+    opt.add<int>("numa", '\0', "numa node to run all stages and allocate all buffers on.", false);
+    opt.add<int>("io-depth", '\0', "reads or writes kept in flight per file, default is 4.", false, 4);
+    opt.add<int>("io-block", '\0', "size in KB of every read or write, default is 1024.", false, 1024);
+    opt.add<std::string>("io-engine", '\0', "file I/O backend, auto picks io_uring when the kernel has it, default is auto.",
+                 false, "auto", cmdline::oneof<std::string>("auto", "uring", "threads"));
+    opt.add("direct", '\0', "open files with O_DIRECT to bypass the page cache, default is NO.");
+    opt.add<std::string>("serve", '\0', "run as a daemon taking jobs on this Unix socket, on one pool of --thread workers.",
+                 false);
+    opt.add<int>("serve-jobs", '\0', "jobs a --serve daemon admits at once, the others wait to be accepted, default is 2.",
+                 false, 2);
+    opt.add<std::string>("connect", '\0', "run the job the other options describe on the daemon at this socket, "
+                 "with at most its --thread workers.", false);
+}
+
+cmdline::parser parameter(int argc, char *argv[]) {
+    cmdline::parser opt;
+    add_options(opt);
     opt.parse_check(argc, argv);
     return opt;
 }
 
-int average_quality(const kseq_t* read, int start, int length) {
-    char* quality = read->qual.s;
-    int sumQ = 0, end = start + length;
-    for(int i = start; i < end; i++)
-        sumQ += quality[i];
-    // Pherd33
-    return sumQ / length - 33;
+// fastq text of a batch, or the gzip members it was compressed to
+uint64_t batch_bytes(const read_batch* b, bool compressed) {
+    const std::string* s = compressed? b->out: b->text;
+    uint64_t n = s[0].size() + s[1].size();
+    for(size_t k = 0; k < b->samples.size(); k++) {
+        s = compressed? b->samples[k].out: b->samples[k].text;
+        n += s[0].size() + s[1].size();
+    }
+    if(b->merged_pairs)
+        n += compressed? b->merged_out.size(): b->merged_text.size();
+    s = compressed? b->screened.out: b->screened.text;
+    return n + s[0].size() + s[1].size();
+}
+
+// the worker loop of a job, on the deflate stream and scratch of a pool thread
+void work(const filter_config& c, batch_queue& todo, batch_queue& done, std::atomic<int>& running, umi_stats& umi,
+    trace_ring* trace, worker_state& state) {
+    z_stream& zs = state.zs;
+    deflateReset(&zs);
+    deflateParams(&zs, c.level, Z_DEFAULT_STRATEGY);
+    batch_filter<keep_pairs> filter = select_filter<keep_pairs>(c);
+    keep_pairs hook;
+    worker_scratch& w = state.w;
+    w.umi = umi_stats();
+    int level = c.level;
+    while(read_batch* b = todo.pop()) {
+        uint64_t traced = trace? trace->now(): 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if(c.decode) {
+            uint32_t records[2] = {0, 0};
+            for(int i = 0; i < 2; i++) {
+                b->text[i].clear();
+                if(!w.unpacker.decode(b->packed[i], b->text[i], &records[i]))
+                    b->damaged = true;
+            }
+            b->decoded_pairs = records[0];
+        } else {
+            filter(b, c, w, hook);
+        }
+        std::chrono::steady_clock::time_point filtered = std::chrono::steady_clock::now();
+        if(trace) {
+            trace->span(c.decode? "decode": "filter", b->id, traced);
+            traced = trace->now();
+        }
+        if(!c.reservoir) {
+            if(c.levels && c.levels->level() != level) {
+                level = c.levels->level();
+                deflateReset(&zs);
+                deflateParams(&zs, level, Z_DEFAULT_STRATEGY);
+            }
+            b->compress_failed = !compress_batch(b, c, w, &zs);
+            if(trace)
+                trace->span("compress", b->id, traced);
+        }
+        if(c.levels) {
+            std::chrono::duration<double> filter_time = filtered - start;
+            std::chrono::duration<double> deflate_time = std::chrono::steady_clock::now() - filtered;
+            c.levels->report(level, batch_bytes(b, false), batch_bytes(b, true), filter_time.count(),
+                             deflate_time.count(), todo.size());
+        }
+        done.push(b);
+    }
+    umi = w.umi;
+    if(--running == 0)
+        done.close();
 }
 
-std::string get_umi(const kseq_t* read1, const kseq_t* read2,
-    int start, int length, char connect = '_') {
-    std::string umi, sequence1, sequence2;
-    sequence1 = read1->seq.s;
-    sequence2 = read2->seq.s;
-    umi = sequence1.substr(start, length) +
-          connect +
-          sequence2.substr(start, length);
-    return umi;
+// the pairs of b the workers will keep: the read level filters and the
+// screen, but not the reservoir, which is only drawn at the end
+template <bool FIXED_LENGTH, int PHRED>
+void select_counted(read_batch* b, const filter_config& c, worker_scratch& w) {
+    select_pairs<FIXED_LENGTH, PHRED>(b, c);
+    if(c.screen)
+        screen_pairs<false, false, false, FIXED_LENGTH>(b, c, w);
 }
 
-gzFile open_file(std::string file_name, int level) {
-    // cpoy from chen
-    gzFile f = gzopen(file_name.c_str(), "w");
-    gzsetparams(f, level, Z_DEFAULT_STRATEGY);
-    gzbuffer(f, 1024*1024);
-    return f;
+// phred offset of the --phred option, auto guesses it from the first batch
+int input_phred(const std::string& phred, const read_batch* first) {
+    return phred == "auto"? batch_phred(first): phred == "64"? 64: 33;
 }
 
-void close_file(gzFile f) {
-    gzflush(f, Z_FINISH);
-    gzclose(f);
+// Counts the UMI of every pair written for directional clustering, a pass
+// ahead of the real one, so that pairs dropped for their quality, Ns or the
+// screen do not pull UMIs into clusters. A reservoir is drawn from all of
+// them.
+bool count_umis(const std::string& read1, const std::string& read2, const io_options& io,
+    read_limits limits, filter_config c, const std::string& phred, umi_corrector& umis, std::string& error) {
+    input_stream in1, in2;
+    for(int i = 0; i < 2; i++)
+        if(!(i? in2: in1).open(i? read2: read1, io)) {
+            error = "can not open " + (i? read2: read1) + ": " + strerror(errno);
+            return false;
+        }
+    kseq_t* reads1 = kseq_init(&in1);
+    kseq_t* reads2 = kseq_init(&in2);
+    // pairs routed to --screened1/--screened2 are written too
+    if(c.route_screened)
+        c.screen = nullptr;
+    bool fixed = c.plan[0].template_length && c.plan[1].template_length;
+    read_batch b;
+    worker_scratch w;
+    std::string umi;
+    for(bool more = true, first = true; more; first = false) {
+        more = fill_batch(reads1, reads2, limits, &b);
+        if(first)
+            c.phred = input_phred(phred, &b);
+        if(fixed)
+            c.phred == 64? select_counted<true, 64>(&b, c, w): select_counted<true, 33>(&b, c, w);
+        else
+            c.phred == 64? select_counted<false, 64>(&b, c, w): select_counted<false, 33>(&b, c, w);
+        for(size_t s = 0; s < b.selected.size(); s++) {
+            size_t r = 2 * b.selected[s];
+            get_umi(umi, c.plan, b.seq(r), b.seq(r + 1));
+            umis.count(umi);
+        }
+    }
+    kseq_destroy(reads1);
+    kseq_destroy(reads2);
+    error = in1.failed()? in1.error(): in2.error();
+    return !in1.failed() && !in2.failed();
 }
 
-void write_read(const kseq_t* read, gzFile file,
-    bool add_comment, char p, std::string umi, int start, int length) {
-    gzputc(file, '@');
-    gzputs(file, read->name.s);
-    if(umi.length()) {
-        gzputc(file, p);
-        gzputs(file, umi.c_str());
+// Reads the fqb blocks of both mates one pair at a time, a block pair per
+// batch. Returns false if the files are damaged or their blocks disagree.
+bool read_block(input_stream& in, std::string& block, bool& end) {
+    char head[8];
+    end = false;
+    if(!read_exact(in, head, 4))
+        return false;
+    if(!memcmp(head, "FQBI", 4)) {
+        end = true;
+        return true;
     }
-    if(add_comment && read->comment.l) {
-        gzputc(file, ' ');
-        gzputs(file, read->comment.s);
+    if(memcmp(head, "FQBK", 4) || !read_exact(in, head + 4, 4))
+        return false;
+    // the size is not trusted: the block grows only as its bytes arrive, so a
+    // damaged one ends at the end of the file rather than allocating 4 GB
+    uint32_t size = get_uint(head + 4, 4);
+    block.assign(head, 8);
+    while(size) {
+        size_t at = block.size(), n = std::min<uint32_t>(size, 1 << 20);
+        block.resize(at + n);
+        if(!read_exact(in, &block[at], n))
+            return false;
+        size -= n;
     }
-    gzputc(file, '\n');
-    gzwrite(file, read->seq.s + start, length);
-    gzputs(file, "\n+\n");
-    gzwrite(file, read->qual.s + start, length);
-    gzputc(file, '\n');
+    return true;
 }
 
-int main(int argc, char *argv[]) {
-    cmdline::parser opt = parameter(argc, argv);
-    int cutQ = opt.get<int>("qual");
-    int level = opt.get<int>("level");
-    bool add_comment = !opt.exist("disComment");
-    bool treat_umi = opt.exist("umi");
-    int umi_start = treat_umi && opt.exist("umiStart") ? opt.get<int>("umiStart"): 0;
-    int umi_length = treat_umi && opt.exist("umiLength")? opt.get<int>("umiLength"): 0;
+bool read_blocks(input_stream& in1, input_stream& in2, batch_pool& pool, batch_queue& todo, trace_ring* trace) {
+    bool ok = true;
+    for(uint64_t id = 0; ; id++) {
+        uint64_t start = trace? trace->now(): 0;
+        read_batch* b = pool.acquire();
+        if(trace) {
+            trace->span("wait for a batch", id, start);
+            start = trace->now();
+        }
+        b->clear();
+        b->id = id;
+        bool end1, end2;
+        ok = read_block(in1, b->packed[0], end1) && read_block(in2, b->packed[1], end2) && end1 == end2 &&
+             (end1 || b->packed[0].compare(8, 4, b->packed[1], 8, 4) == 0);
+        if(!ok || end1) {
+            pool.release(b);
+            break;
+        }
+        todo.push(b);
+        if(trace) {
+            trace->span("read", id, start);
+            trace->counter("todo", todo.size());
+        }
+    }
+    todo.close();
+    return ok;
+}
+
+// bytes of the fastq record at the start of text, four lines
+size_t record_length(const char* text, const char* end) {
+    const char* p = text;
+    for(int i = 0; i < 4 && p < end; i++) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        p = eol? eol + 1: end;
+    }
+    return p - text;
+}
+
+// hands the formatted pairs of a batch to the reservoir
+void offer_batch(pair_reservoir& reservoir, const read_batch* b) {
+    const char* text[2] = {b->text[0].data(), b->text[1].data()};
+    const char* end[2] = {text[0] + b->text[0].size(), text[1] + b->text[1].size()};
+    for(size_t s = 0; s < b->selected.size(); s++) {
+        size_t l1 = record_length(text[0], end[0]), l2 = record_length(text[1], end[1]);
+        reservoir.offer(b->hashes[s], b->id << 32 | b->selected[s], text[0], l1, text[1], l2);
+        text[0] += l1;
+        text[1] += l2;
+    }
+}
+
+// Writes the compressed batches and hands them back to the pool, false if
+// any of them could not be decoded; compressed is cleared if any of them
+// could not be compressed. Ordered output holds finished batches
+// back until all earlier ones are written; unordered output writes each
+// as soon as its worker is done, keeping read1 and read2 in step.
+bool write_pairs(std::vector<output_files>& files, pair_reservoir* reservoir, bool ordered,
+    batch_pool& pool, batch_queue& done, trace_ring* trace, bool& compressed) {
+    std::map<uint64_t, read_batch*> pending;
+    uint64_t next = 0;
+    bool ok = true;
+    while(read_batch* b = done.pop()) {
+        uint64_t start = trace? trace->now(): 0;
+        if(trace)
+            trace->counter("done", done.size());
+        if(reservoir) {
+            offer_batch(*reservoir, b);
+            if(trace)
+                trace->span("offer", b->id, start);
+            pool.release(b);
+            continue;
+        }
+        if(!ordered) {
+            ok = ok && !b->damaged;
+            compressed = compressed && !b->compress_failed;
+            write_batch(files, b);
+            if(trace)
+                trace->span("write", b->id, start);
+            pool.release(b);
+            continue;
+        }
+        pending[b->id] = b;
+        while(!pending.empty() && pending.begin()->first == next) {
+            read_batch* w = pending.begin()->second;
+            pending.erase(pending.begin());
+            ok = ok && !w->damaged;
+            compressed = compressed && !w->compress_failed;
+            write_batch(files, w);
+            if(trace) {
+                trace->span("write", w->id, start);
+                start = trace->now();
+            }
+            pool.release(w);
+            next++;
+        }
+        if(trace)
+            trace->counter("held for order", pending.size());
+    }
+    return ok;
+}
+
+// writes the pairs sampled into the reservoir in input order, a gzip member
+// every few MB
+void write_reservoir(output_files& files, pair_reservoir& reservoir, int level) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    std::vector<pair_reservoir::entry>& pairs = reservoir.sorted();
+    std::string text[2], out[2];
+    uint32_t n = 0;
+    for(size_t i = 0; i < pairs.size(); i++) {
+        for(int m = 0; m < 2; m++)
+            text[m] += pairs[i].text[m];
+        n++;
+        if(text[0].size() >= (4 << 20) || i + 1 == pairs.size()) {
+            uint32_t crc[2];
+            compress_texts(&zs, text, out, crc);
+            files.write(out, n, text, crc);
+            text[0].clear();
+            text[1].clear();
+            n = 0;
+        }
+    }
+    deflateEnd(&zs);
+}
+
+// --probe: reports on the first batch of pairs and stops reading there
+int probe_inputs(const std::string& read1, const std::string& read2, const io_options& io, std::ostream& report,
+    std::ostream& log) {
+    input_stream in1, in2;
+    for(int i = 0; i < 2; i++)
+        if(!(i? in2: in1).open(i? read2: read1, io)) {
+            log << "Error: can not open " << (i? read2: read1) << ": " << strerror(errno) << std::endl;
+            return -1;
+        }
+    kseq_t* reads1 = kseq_init(&in1);
+    kseq_t* reads2 = kseq_init(&in2);
+    read_limits limits;
+    read_batch b;
+    bool complete = !fill_batch(reads1, reads2, limits, &b);
+    kseq_destroy(reads1);
+    kseq_destroy(reads2);
+    if(in1.failed() || in2.failed()) {
+        log << "Error: " << (in1.failed()? in1.error(): in2.error()) << std::endl;
+        return -1;
+    }
+    probe_pairs(&b, complete, report);
+    return 0;
+}
+
+// an output file for --manifest, with the count of records written to it
+// and the CRC32 of its fastq
+struct manifest_entry {
+    std::string path;
+    async_writer* file;
+    const uint64_t* records;
+    const stream_crc* crc;
+
+    manifest_entry(const std::string& p, async_writer* f, const uint64_t* r, const stream_crc* c):
+        path(p), file(f), records(r), crc(c) {}
+};
+
+// a line of tab separated columns per output; fqb output has no fastq to
+// take a CRC32 of
+bool write_manifest(const std::string& path, std::vector<manifest_entry>& manifest, bool fastq) {
+    std::ofstream out(path.c_str());
+    out << "#file\trecords\tfastq_bytes\tfastq_crc32\tbytes\tmd5\n";
+    for(size_t e = 0; e < manifest.size(); e++) {
+        const manifest_entry& m = manifest[e];
+        out << m.path << '\t' << *m.records << '\t';
+        if(fastq)
+            out << m.crc->bytes << '\t' << std::hex << std::setw(8) << std::setfill('0') << m.crc->crc << std::dec;
+        else
+            out << "-\t-";
+        out << '\t' << m.file->digest().bytes() << '\t' << m.file->digest().hex() << '\n';
+    }
+    out.close();
+    return !out.fail();
+}
+
+// pattern with every {sample} replaced by the sample's name
+std::string sample_path(std::string pattern, const std::string& sample) {
+    for(size_t at = pattern.find("{sample}"); at != std::string::npos; at = pattern.find("{sample}", at + sample.size()))
+        pattern.replace(at, 8, sample);
+    return pattern;
+}
+
+// One run of the filter on the options, with its workers from the pool, the
+// report of --probe to report and its messages to log. --probe reads on the
+// calling thread and takes no pool.
+int run(const cmdline::parser& opt, worker_pool* workers, std::ostream& report, std::ostream& log) {
+    if(!opt.exist("read1") || !opt.exist("read2")) {
+        log << "Error: --read1 and --read2 are required" << std::endl;
+        return -1;
+    }
+    if(!opt.exist("probe") && (!opt.exist("out1") || !opt.exist("out2"))) {
+        log << "Error: --out1 and --out2 are required" << std::endl;
+        return -1;
+    }
+    filter_config c;
+    c.cutQ = opt.get<int>("qual");
+    c.level = opt.get<int>("level");
+    c.add_comment = !opt.exist("disComment");
+    c.treat_umi = opt.exist("umi");
     std::string connection = opt.get<std::string>("connection");
-    char prefix;
-    if(connection == "S") prefix = ' ';
-    if(connection == "C") prefix = ':';
-    if(connection == "U") prefix = '_';
-    int seq_start = treat_umi && opt.exist("readStart")? opt.get<int>("readStart"): 0; //
-    int seq_length = opt.exist("readLength")? opt.get<int>("readLength"): 0; //
-    if(treat_umi) {
+    if(connection == "S") c.prefix = ' ';
+    if(connection == "C") c.prefix = ':';
+    if(connection == "U") c.prefix = '_';
+    c.max_n = opt.get<int>("maxN");
+    c.packed = opt.get<std::string>("format") == "fqb";
+    c.zstd = opt.get<std::string>("format") == "zst";
+    c.decode = opt.exist("decode");
+    c.checksums = opt.exist("manifest");
+    int threads = opt.get<int>("thread");
+    if(opt.exist("structure1") || opt.exist("structure2")) {
+        if(opt.exist("umiStart") || opt.exist("umiLength") || opt.exist("readStart") || opt.exist("readLength")) {
+            log << "Error: --structure1/--structure2 replace --umiStart, --umiLength, --readStart and --readLength" << std::endl;
+            return -1;
+        }
+        const char* names[2] = {"structure1", "structure2"};
+        for(int i = 0; i < 2; i++) {
+            std::string error;
+            if(!compile_structure(opt.exist(names[i])? opt.get<std::string>(names[i]): "+T", c.plan[i], error)) {
+                log << "Error: --" << names[i] << ": " << error << std::endl;
+                return -1;
+            }
+        }
+        c.treat_umi = !c.plan[0].umi.empty() || !c.plan[1].umi.empty();
+    } else if(c.treat_umi) {
         if(!opt.exist("umiStart") || !opt.exist("umiLength") || !opt.exist("readStart")) {
-            std::cerr << "Error: --umiStart, --umiLength and --readStart are all need for umi treat" << std::endl;
+            log << "Error: --umiStart, --umiLength and --readStart are all need for umi treat" << std::endl;
             return -1;
         }
     } else {
         if(opt.exist("umiStart") || opt.exist("umiLength") || opt.exist("readStart")) {
-            std::cerr << "Error: it seems that you want do umi treat, but lack of --umi" << std::endl;
+            log << "Error: it seems that you want do umi treat, but lack of --umi" << std::endl;
+            return -1;
+        }
+    }
+    if(!opt.exist("structure1") && !opt.exist("structure2")) {
+        int umi_start = c.treat_umi? opt.get<int>("umiStart"): 0;
+        int umi_length = c.treat_umi? opt.get<int>("umiLength"): 0;
+        int seq_start = c.treat_umi? opt.get<int>("readStart"): 0;
+        int seq_length = opt.exist("readLength")? opt.get<int>("readLength"): 0;
+        c.plan[0] = c.plan[1] = read_plan::offsets(umi_start, umi_length, seq_start, seq_length);
+    }
+    int umi_length1 = c.plan[0].umi_length(), umi_length2 = c.plan[1].umi_length();
+    if(threads < 1) {
+        log << "Error: --thread should be at least 1" << std::endl;
+        return -1;
+    }
+    if(workers)
+        threads = std::min(threads, workers->size());
+    if((opt.exist("umiWhitelist") || opt.exist("umiCluster")) && !c.treat_umi) {
+        log << "Error: UMI correction needs a UMI, from --umi or an M segment of a read structure" << std::endl;
+        return -1;
+    }
+    if(opt.exist("umiWhitelist") && opt.exist("umiCluster")) {
+        log << "Error: choose one of --umiWhitelist and --umiCluster" << std::endl;
+        return -1;
+    }
+    if(opt.exist("umiCluster") && opt.get<int>("umiMaxDistinct") < 1) {
+        log << "Error: --umiMaxDistinct should be at least 1" << std::endl;
+        return -1;
+    }
+    if(opt.exist("umiWhitelist") && ((umi_length1 && umi_length2 && umi_length1 != umi_length2) ||
+                                     std::max(umi_length1, umi_length2) > 31)) {
+        log << "Error: --umiWhitelist needs UMIs of the same length, at most 31, on read1 and read2" << std::endl;
+        return -1;
+    }
+    if(opt.exist("umiCluster") && umi_length1 + umi_length2 > 31) {
+        log << "Error: --umiCluster needs UMIs of at most 31 bases over both reads" << std::endl;
+        return -1;
+    }
+    if(c.decode && (c.packed || c.zstd)) {
+        log << "Error: --decode writes gzip fastq, it can not be used with --format fqb or zst" << std::endl;
+        return -1;
+    }
+#ifndef HAVE_ZSTD
+    if(c.zstd) {
+        log << "Error: --format zst needs a build with make ZSTD=1" << std::endl;
+        return -1;
+    }
+#endif
+    if(c.zstd && (c.level < 1 || c.level > 19)) {
+        log << "Error: --level should be 1 to 19 for --format zst" << std::endl;
+        return -1;
+    }
+    if(opt.exist("zstd-dict") && !c.zstd) {
+        log << "Error: --zstd-dict needs --format zst" << std::endl;
+        return -1;
+    }
+    sample_sheet sheet;
+    c.samples = nullptr;
+    c.inline_barcode = false;
+    if(opt.exist("samples")) {
+        std::string error;
+        if(c.decode) {
+            log << "Error: --samples can not be used with --decode" << std::endl;
+            return -1;
+        }
+        if(!sheet.load(opt.get<std::string>("samples"), opt.get<int>("barcode-mismatches") > 0, error)) {
+            log << "Error: " << error << std::endl;
+            return -1;
+        }
+        int inline_length = c.plan[0].barcode_length() + c.plan[1].barcode_length();
+        c.inline_barcode = inline_length > 0;
+        if(c.inline_barcode && inline_length != sheet.barcode_length()) {
+            log << "Error: the B segments of the read structures hold " << inline_length
+                      << " bases but the barcodes of --samples have " << sheet.barcode_length() << std::endl;
+            return -1;
+        }
+        if(opt.get<std::string>("out1").find("{sample}") == std::string::npos ||
+           opt.get<std::string>("out2").find("{sample}") == std::string::npos) {
+            log << "Error: --samples needs {sample} in --out1 and --out2" << std::endl;
+            return -1;
+        }
+        c.samples = &sheet;
+    }
+    double fraction = opt.get<double>("sample-fraction");
+    if(!(fraction > 0 && fraction <= 1)) {
+        log << "Error: --sample-fraction should be above 0 and at most 1" << std::endl;
+        return -1;
+    }
+    read_limits limits;
+    c.seed = opt.get<int>("seed");
+    limits.set_fraction(fraction, c.seed);
+    if(opt.exist("max-pairs")) {
+        if(opt.get<long long>("max-pairs") < 1) {
+            log << "Error: --max-pairs should be at least 1" << std::endl;
+            return -1;
+        }
+        limits.set_max_pairs(opt.get<long long>("max-pairs"));
+    }
+    if(c.decode && (fraction < 1 || opt.exist("max-pairs") || opt.exist("reservoir"))) {
+        log << "Error: --decode converts whole files, it can not sample them" << std::endl;
+        return -1;
+    }
+    std::unique_ptr<level_controller> levels;
+    c.levels = nullptr;
+    if(opt.exist("target-mbps")) {
+        int min_level = opt.get<int>("min-level"), max_level = opt.get<int>("max-level");
+        if(!(opt.get<double>("target-mbps") > 0) || min_level < 1 || min_level > max_level || max_level > 9) {
+            log << "Error: --target-mbps should be above 0 and 1 <= --min-level <= --max-level <= 9" << std::endl;
+            return -1;
+        }
+        if(c.packed || c.zstd || opt.exist("reservoir")) {
+            log << "Error: --target-mbps adapts the gzip level, it can not be used with --format fqb, zst or --reservoir" << std::endl;
+            return -1;
+        }
+        c.level = std::max(min_level, std::min(max_level, c.level));
+        levels.reset(new level_controller(min_level, max_level, c.level, opt.get<double>("target-mbps"), threads));
+        c.levels = levels.get();
+    }
+    std::unique_ptr<pair_reservoir> reservoir;
+    c.reservoir = nullptr;
+    if(opt.exist("reservoir")) {
+        if(opt.get<long long>("reservoir") < 1) {
+            log << "Error: --reservoir should be at least 1" << std::endl;
             return -1;
         }
+        if(c.packed || c.zstd || c.samples) {
+            log << "Error: --reservoir writes gzip fastq, it can not be used with --format fqb, zst or --samples" << std::endl;
+            return -1;
+        }
+        reservoir.reset(new pair_reservoir(opt.get<long long>("reservoir")));
+        c.reservoir = reservoir.get();
+    }
+    std::string reorder = opt.get<std::string>("reorder");
+    c.reorder = reorder == "minimizer"? REORDER_MINIMIZER: reorder == "umi"? REORDER_UMI: REORDER_NONE;
+    if(c.reorder && (c.decode || c.reservoir)) {
+        log << "Error: --reorder can not be used with --decode or --reservoir" << std::endl;
+        return -1;
+    }
+    if(c.reorder == REORDER_UMI && !c.treat_umi) {
+        log << "Error: --reorder umi needs UMIs, from --umi or M segments of --structure1/--structure2" << std::endl;
+        return -1;
+    }
+    read_merger merger(opt.get<int>("merge-overlap"), opt.get<int>("merge-mismatch"));
+    c.merger = nullptr;
+    if(opt.exist("merged")) {
+        if(opt.get<int>("merge-overlap") < 1 || opt.get<int>("merge-mismatch") < 0 || opt.get<int>("merge-mismatch") > 100) {
+            log << "Error: --merge-overlap should be at least 1 and --merge-mismatch 0 to 100" << std::endl;
+            return -1;
+        }
+        if(c.packed || c.decode || c.samples || c.reservoir) {
+            log << "Error: --merged can not be used with --format fqb, --decode, --samples or --reservoir" << std::endl;
+            return -1;
+        }
+        c.merger = &merger;
+    }
+
+    stage_placement placement;
+    if(opt.exist("cpus")) {
+        placement.cpus = parse_cpu_list(opt.get<std::string>("cpus"));
+        if(placement.cpus.empty()) {
+            log << "Error: can not parse --cpus " << opt.get<std::string>("cpus") << std::endl;
+            return -1;
+        }
+    }
+    if(opt.exist("numa")) {
+        std::vector<int> node = numa_node_cpus(opt.get<int>("numa"));
+        if(node.empty()) {
+            log << "Error: numa node " << opt.get<int>("numa") << " has no cpus" << std::endl;
+            return -1;
+        }
+        if(placement.cpus.empty()) {
+            placement.cpus = node;
+        } else {
+            std::vector<int> both;
+            for(size_t i = 0; i < placement.cpus.size(); i++)
+                if(std::find(node.begin(), node.end(), placement.cpus[i]) != node.end())
+                    both.push_back(placement.cpus[i]);
+            if(both.empty()) {
+                log << "Error: none of --cpus is on numa node " << opt.get<int>("numa") << std::endl;
+                return -1;
+            }
+            placement.cpus = both;
+        }
+    }
+    if(!pin_to_cpu(placement.writer())) {
+        log << "Error: can not pin to cpu " << placement.writer() << std::endl;
+        return -1;
+    }
+
+    io_options io;
+    io.depth = opt.get<int>("io-depth");
+    io.block = (size_t)opt.get<int>("io-block") * 1024;
+    io.engine = opt.get<std::string>("io-engine");
+    io.direct = opt.exist("direct");
+    if(io.depth < 1 || opt.get<int>("io-block") < 4) {
+        log << "Error: --io-depth should be at least 1 and --io-block at least 4" << std::endl;
+        return -1;
+    }
+    if(opt.exist("probe"))
+        return probe_inputs(opt.get<std::string>("read1"), opt.get<std::string>("read2"), io, report, log);
+    kmer_screen screen;
+    c.screen = nullptr;
+    if(opt.exist("screen")) {
+        c.screen_fraction = opt.get<double>("screen-fraction");
+        c.route_screened = opt.exist("screened1") || opt.exist("screened2");
+        if(opt.get<int>("screen-k") < 1 || opt.get<int>("screen-k") > 32 || !(c.screen_fraction > 0 && c.screen_fraction <= 1)) {
+            log << "Error: --screen-k should be 1 to 32 and --screen-fraction above 0 and at most 1" << std::endl;
+            return -1;
+        }
+        if(c.decode) {
+            log << "Error: --screen can not be used with --decode" << std::endl;
+            return -1;
+        }
+        if(c.route_screened && (!opt.exist("screened1") || !opt.exist("screened2"))) {
+            log << "Error: --screened1 and --screened2 go together" << std::endl;
+            return -1;
+        }
+        if(c.route_screened && (c.packed || c.reservoir)) {
+            log << "Error: --screened1/--screened2 can not be used with --format fqb or --reservoir" << std::endl;
+            return -1;
+        }
+        std::string path = opt.get<std::string>("screen"), error;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool saved = screen.load(path, error);
+        if(!saved && (!error.empty() || !build_screen(path, opt.get<int>("screen-k"), io, screen, error))) {
+            log << "Error: --screen: " << error << std::endl;
+            return -1;
+        }
+        if(opt.exist("screen-save") && !screen.save(opt.get<std::string>("screen-save"), error)) {
+            log << "Error: --screen-save: " << error << std::endl;
+            return -1;
+        }
+        std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+        log << "screen: " << (saved? "mapped ": "built ") << screen.bytes() / 1e6 << " MB filter of " << screen.k()
+                  << "-mers in " << took.count() << " s" << std::endl;
+        c.screen = &screen;
+    } else if(opt.exist("screened1") || opt.exist("screened2") || opt.exist("screen-save")) {
+        log << "Error: --screened1, --screened2 and --screen-save need --screen" << std::endl;
+        return -1;
+    }
+
+    input_stream fp1, fp2;
+    for(int i = 0; i < 2; i++) {
+        std::string name = opt.get<std::string>(i? "read2": "read1");
+        if(!(i? fp2: fp1).open(name, io)) {
+            log << "Error: can not open " << name << ": " << strerror(errno) << std::endl;
+            return -1;
+        }
+    }
+    // every sample has writers of its own, with fewer and smaller buffers so
+    // that a sheet of a hundred samples still fits in memory
+    io_options out_io = io;
+    size_t outputs = c.samples? c.samples->size() + 1: 1;
+    if(c.samples) {
+        out_io.depth = std::min(io.depth, 2);
+        out_io.block = std::min<size_t>(io.block, 256 << 10);
+    }
+    // All outputs are written from the writer thread, on one engine: an
+    // engine per file is a ring or depth threads per file, which a sheet of
+    // a few hundred samples runs out of descriptors on. It is declared, like
+    // the hasher, ahead of the files, whose writers use it until they close.
+    // The ring is capped at 4096 entries, past them a submit waits for a
+    // completion first.
+    unsigned entries = std::min<size_t>(2 * outputs * out_io.depth + 3 * io.depth, 4096);
+    std::unique_ptr<io_engine> out_engine(make_engine(io, entries));
+    if(!out_engine) {
+        log << "Error: can not start the output engine: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    std::unique_ptr<md5_thread> hasher;
+    std::vector<manifest_entry> manifest;
+    std::vector<output_files> files(outputs);
+    for(size_t k = 0; k < files.size(); k++)
+        for(int i = 0; i < 2; i++) {
+            std::string name = opt.get<std::string>(i? "out2": "out1");
+            if(c.samples)
+                name = sample_path(name, c.samples->name(k));
+            if(!files[k].out[i].open(name, out_io, out_engine.get())) {
+                log << "Error: can not open " << name << ": " << strerror(errno) << std::endl;
+                return -1;
+            }
+            manifest.push_back(manifest_entry(name, &files[k].out[i], &files[k].pairs, &files[k].crc[i]));
+        }
+    if(c.merger) {
+        if(!files[0].merged.open(opt.get<std::string>("merged"), io, out_engine.get())) {
+            log << "Error: can not open " << opt.get<std::string>("merged") << ": " << strerror(errno) << std::endl;
+            return -1;
+        }
+        manifest.push_back(manifest_entry(opt.get<std::string>("merged"), &files[0].merged, &files[0].merged_pairs,
+                                          &files[0].merged_crc));
+    }
+    for(int i = 0; i < 2 && c.route_screened; i++) {
+        std::string name = opt.get<std::string>(i? "screened2": "screened1");
+        if(!files[0].screened[i].open(name, io, out_engine.get())) {
+            log << "Error: can not open " << name << ": " << strerror(errno) << std::endl;
+            return -1;
+        }
+        manifest.push_back(manifest_entry(name, &files[0].screened[i], &files[0].screened_pairs, &files[0].screened_crc[i]));
+    }
+    if(opt.exist("manifest")) {
+        hasher.reset(new md5_thread);
+        for(size_t e = 0; e < manifest.size(); e++)
+            manifest[e].file->hash(hasher.get());
+    }
+
+    if(c.decode) {
+        char magic1[4], magic2[4];
+        if(!read_exact(fp1, magic1, 4) || !read_exact(fp2, magic2, 4) ||
+           memcmp(magic1, FQB_MAGIC, 4) || memcmp(magic2, FQB_MAGIC, 4)) {
+            log << "Error: --decode needs fqb files as read1 and read2" << std::endl;
+            return -1;
+        }
+    }
+    umi_corrector umis;
+    c.umis = nullptr;
+    if(opt.exist("umiWhitelist")) {
+        std::string error;
+        if(!umis.load_whitelist(opt.get<std::string>("umiWhitelist"), umi_length1, umi_length2, error)) {
+            log << "Error: " << error << std::endl;
+            return -1;
+        }
+        c.umis = &umis;
     }
+    if(opt.exist("umiCluster")) {
+        umis.start_counting(umi_length1, umi_length2, opt.get<int>("umiMaxDistinct"));
+        std::string error;
+        if(!count_umis(opt.get<std::string>("read1"), opt.get<std::string>("read2"), io, limits, c,
+                       opt.get<std::string>("phred"), umis, error)) {
+            log << "Error: " << error << std::endl;
+            return -1;
+        }
+        umis.cluster();
+        log << "UMI clustering: " << umis.distinct() << " distinct UMIs in " << umis.clusters() << " clusters";
+        if(umis.overflow())
+            log << ", " << umis.overflow() << " pairs beyond --umiMaxDistinct";
+        log << std::endl;
+        c.umis = &umis;
+    }
+
+    if(c.packed)
+        for(size_t k = 0; k < files.size(); k++)
+            for(int i = 0; i < 2; i++)
+                files[k].out[i].write(FQB_MAGIC, sizeof(FQB_MAGIC));
+
+    kseq_t* reads1 = kseq_init(&fp1);
+    kseq_t* reads2 = kseq_init(&fp2);
+
+    // two batches per worker keep every stage busy, the rest absorb reordering
+    batch_pool pool(2 * threads + 4);
+    if(!placement.cpus.empty())
+        pool.prefault(BATCH_PAIRS * 512, BATCH_PAIRS * 512);
+    batch_queue todo(pool.size()), done(pool.size());
 
-    gzFile fp1, fp2, out1, out2;
-    fp1 = gzopen(opt.get<std::string>("read1").c_str(), "r");
-    fp2 = gzopen(opt.get<std::string>("read2").c_str(), "r");
-    out1 = open_file(opt.get<std::string>("out1"), level);
-    out2 = open_file(opt.get<std::string>("out2"), level);
+    // a ring per thread: the reader, the workers, then the writer
+    std::unique_ptr<tracer> trace;
+    std::vector<trace_ring*> rings(threads + 2, nullptr);
+    if(opt.exist("trace")) {
+        trace.reset(new tracer);
+        rings[0] = trace->thread("reader");
+        for(int i = 0; i < threads; i++)
+            rings[i + 1] = trace->thread("worker " + std::to_string(i));
+        rings[threads + 1] = trace->thread("writer");
+    }
 
-    kseq_t* reads1 = kseq_init(fp1);
-    kseq_t* reads2 = kseq_init(fp2);
-    std::string UMISeq;
-    int seq1_end, seq2_end, q1, q2;
-    while (kseq_read(reads1) >= 0) {
-        kseq_read(reads2);
-        seq1_end = seq_length? seq_length: reads1->seq.l - seq_start;
-        seq2_end = seq_length? seq_length: reads2->seq.l - seq_start;
-        q1 = average_quality(reads1, seq_start, seq1_end);
-        q2 = average_quality(reads2, seq_start, seq2_end);
-        if(q1 >= cutQ && q2 >= cutQ) {
-            UMISeq = treat_umi? get_umi(reads1, reads2, umi_start, umi_length): "";
-            write_read(reads1, out1, add_comment, prefix, UMISeq, seq_start, seq1_end);
-            write_read(reads2, out2, add_comment, prefix, UMISeq, seq_start, seq2_end);
+    // the first batch is read up front to detect the quality encoding and to
+    // train the zstd dictionary on
+    bool more = false;
+    read_batch* first = nullptr;
+    if(!c.decode) {
+        uint64_t start = trace? rings[0]->now(): 0;
+        first = pool.acquire();
+        more = fill_batch(reads1, reads2, limits, first);
+        if(trace)
+            rings[0]->span("read", 0, start);
+        first->id = 0;
+        c.phred = input_phred(opt.get<std::string>("phred"), first);
+        if(opt.get<int>("qbin"))
+            c.bins = quality_bins(opt.get<int>("qbin"), c.phred);
+        todo.push(first);
+    }
+#ifdef HAVE_ZSTD
+    zstd_dictionary dict;
+    c.dict = &dict;
+    if(c.zstd) {
+        std::string error;
+        if(opt.exist("zstd-dict")) {
+            if(!dict.load(opt.get<std::string>("zstd-dict"), error)) {
+                log << "Error: --zstd-dict: " << error << std::endl;
+                return -1;
+            }
+        } else if(!train_dictionary(first, c.level, dict, error)) {
+            log << "zstd dictionary: not used (" << error << ")" << std::endl;
         }
+        dict.prepare(c.level);
+        std::string frame = dict.frame();
+        for(size_t k = 0; k < files.size(); k++)
+            for(int i = 0; i < 2; i++)
+                files[k].out[i].write(frame.data(), frame.size());
+        if(c.merger)
+            files[0].merged.write(frame.data(), frame.size());
+        for(int i = 0; i < 2 && c.route_screened; i++)
+            files[0].screened[i].write(frame.data(), frame.size());
     }
+#endif
+
+    std::atomic<int> running(threads);
+    bool blocks_ok = true;
+    std::thread reader([&] {
+        pin_to_cpu(placement.reader());
+        if(c.decode)
+            blocks_ok = read_blocks(fp1, fp2, pool, todo, rings[0]);
+        else if(more)
+            read_pairs(reads1, reads2, limits, pool, todo, 1, rings[0]);
+        else
+            todo.close();
+    });
+    // the last worker to finish closes done, so once write_pairs returns
+    // none of them touches the job any more
+    std::vector<umi_stats> umi(threads);
+    for(int i = 0; i < threads; i++)
+        workers->submit([&, i](worker_state& state) {
+            scoped_pin pin(placement.worker(i));
+            if(placement.cpus.empty()) {
+                work(c, todo, done, running, umi[i], rings[i + 1], state);
+                return;
+            }
+            // the warm state was touched first wherever the pool started, so a
+            // placed job allocates its deflate stream and scratch anew on the
+            // node it is pinned to
+            worker_state local;
+            work(c, todo, done, running, umi[i], rings[i + 1], local);
+        });
+    bool compressed = true;
+    bool decoded = write_pairs(files, reservoir.get(), !opt.exist("unordered"), pool, done, rings[threads + 1], compressed);
+    reader.join();
 
     kseq_destroy(reads1);
     kseq_destroy(reads2);
-    gzclose(fp1);
-    gzclose(fp2);
-    close_file(out1);
-    close_file(out2);
+    if(reservoir)
+        write_reservoir(files[0], *reservoir, c.level);
+    if(levels)
+        levels->summary(log);
+    if(c.umis) {
+        umi_stats total;
+        for(int i = 0; i < threads; i++)
+            total.add(umi[i]);
+        log << "UMI correction: " << total.exact << " unchanged, " << total.corrected << " corrected, "
+                  << total.failed << " not correctable" << std::endl;
+    }
+    if(c.samples)
+        for(size_t k = 0; k < files.size(); k++)
+            log << c.samples->name(k) << '\t' << files[k].pairs << " pairs" << std::endl;
+    if(c.merger)
+        log << "merged: " << files[0].merged_pairs << " of " << files[0].merged_pairs + files[0].pairs
+                  << " passing pairs" << std::endl;
+    if(c.screen) {
+        uint64_t passing = files[0].merged_pairs + files[0].screened_pairs;
+        for(size_t k = 0; k < files.size(); k++)
+            passing += files[k].pairs;
+        log << "screened: " << files[0].screened_pairs << " of " << passing << " passing pairs" << std::endl;
+    }
+    if(c.reorder && !c.packed) {
+        uint64_t fastq = 0, written = 0;
+        for(size_t k = 0; k < files.size(); k++)
+            for(int i = 0; i < 2; i++) {
+                fastq += files[k].crc[i].bytes;
+                written += files[k].out[i].bytes();
+            }
+        log << "reorder: " << fastq / 1e6 << " MB of fastq in out1/out2 written as " << written / 1e6 << " MB, "
+            << (written? (double)fastq / written: 0) << " to 1" << std::endl;
+    }
+    for(size_t k = 0; k < files.size(); k++)
+        for(int i = 0; i < 2; i++)
+            if(!close_file(files[k].out[i], c.level, !c.zstd, c.packed? &files[k].index[i]: nullptr)) {
+                log << "Error: writing output failed: " << strerror(errno) << std::endl;
+                return -1;
+            }
+    if(c.merger && !close_file(files[0].merged, c.level, !c.zstd, nullptr)) {
+        log << "Error: writing output failed: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    for(int i = 0; i < 2 && c.route_screened; i++)
+        if(!close_file(files[0].screened[i], c.level, !c.zstd, nullptr)) {
+            log << "Error: writing output failed: " << strerror(errno) << std::endl;
+            return -1;
+        }
+    uint64_t dropped = 0;
+    if(trace && !trace->write(opt.get<std::string>("trace"), dropped)) {
+        log << "Error: can not write " << opt.get<std::string>("trace") << std::endl;
+        return -1;
+    }
+    if(dropped)
+        log << "trace: the first " << dropped << " events were overwritten" << std::endl;
+    if(hasher) {
+        hasher->drain();
+        if(!write_manifest(opt.get<std::string>("manifest"), manifest, !c.packed)) {
+            log << "Error: can not write " << opt.get<std::string>("manifest") << std::endl;
+            return -1;
+        }
+    }
+    if(fp1.failed() || fp2.failed()) {
+        log << "Error: " << (fp1.failed()? fp1.error(): fp2.error()) << std::endl;
+        return -1;
+    }
+    if(!blocks_ok || !decoded) {
+        log << "Error: fqb input is damaged or read1 and read2 do not match" << std::endl;
+        return -1;
+    }
+    if(!compressed) {
+        log << "Error: zstd could not compress the output" << std::endl;
+        return -1;
+    }
 
     return 0;
 }
+
+// options naming files, which a job of --serve takes relative to the
+// working directory of its client
+bool path_option(const std::string& name) {
+    static const char* names[] = {"read1", "read2", "out1", "out2", "merged", "samples", "umiWhitelist", "zstd-dict",
+                                  "screen", "screen-save", "screened1", "screened2", "manifest", "trace",
+                                  "1", "2", "3", "4", "5"};
+    for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        if(name == names[i])
+            return true;
+    return false;
+}
+
+std::string absolute_path(const std::string& directory, const std::string& path) {
+    return path.empty() || path[0] == '/'? path: directory + "/" + path;
+}
+
+// a job of --serve: the client's working directory, then its arguments
+int run_job(const std::vector<std::string>& request, worker_pool& workers, std::ostream& log) {
+    std::vector<std::string> args(request.begin() + 1, request.end());
+    for(size_t i = 1; i < args.size(); i++) {
+        const std::string& a = args[i];
+        size_t dashes = a.compare(0, 2, "--") == 0? 2: a.size() == 2 && a[0] == '-'? 1: 0, eq = a.find('=');
+        if(dashes == 2 && eq != std::string::npos) {
+            if(path_option(a.substr(2, eq - 2)))
+                args[i] = a.substr(0, eq + 1) + absolute_path(request[0], a.substr(eq + 1));
+        } else if(dashes && path_option(a.substr(dashes)) && i + 1 < args.size()) {
+            args[i + 1] = absolute_path(request[0], args[i + 1]);
+            i++;
+        }
+    }
+    cmdline::parser opt;
+    add_options(opt);
+    if(!opt.parse(args)) {
+        log << opt.error_full() << opt.usage();
+        return -1;
+    }
+    if(opt.exist("serve") || opt.exist("connect")) {
+        log << "Error: a job can not --serve or --connect" << std::endl;
+        return -1;
+    }
+    return run(opt, &workers, log, log);
+}
+
+int main(int argc, char *argv[]) {
+    cmdline::parser opt = parameter(argc, argv);
+    if(opt.exist("connect")) {
+        std::vector<std::string> request(1, ".");
+        char* cwd = getcwd(nullptr, 0);
+        if(cwd)
+            request[0] = cwd;
+        free(cwd);
+        for(int i = 0; i < argc; i++) {
+            std::string a = argv[i];
+            if(a == "--connect")
+                i++;
+            else if(a.compare(0, 10, "--connect=") != 0)
+                request.push_back(a);
+        }
+        return submit(opt.get<std::string>("connect"), request, std::cerr);
+    }
+    if(opt.exist("serve")) {
+        if(opt.get<int>("serve-jobs") < 1) {
+            std::cerr << "Error: --serve-jobs should be at least 1" << std::endl;
+            return -1;
+        }
+        worker_pool workers(std::max(1, opt.get<int>("thread")));
+        job_runner job = [&](const std::vector<std::string>& request, std::ostream& log) {
+            return run_job(request, workers, log);
+        };
+        return serve(opt.get<std::string>("serve"), job, opt.get<int>("serve-jobs"), std::cerr);
+    }
+    if(opt.exist("probe"))
+        return run(opt, nullptr, std::cout, std::cerr);
+    worker_pool workers(std::max(1, opt.get<int>("thread")));
+    return run(opt, &workers, std::cout, std::cerr);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// bases that differ between a and b over l, sixteen compared per
+// instruction; the count stops being exact once it passes limit
+inline int mismatches(const char* a, const char* b, int l, int limit) {
+    int n = 0, i = 0;
+#ifdef __SSE2__
+    for(; i + 16 <= l && n <= limit; i += 16) {
+        __m128i same = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+        n += 16 - __builtin_popcount(_mm_movemask_epi8(same));
+    }
+#endif
+    for(; i < l && n <= limit; i++)
+        n += a[i] != b[i];
+    return n;
+}
+
+inline char complement(char base) {
+    switch(base) {
+    case 'A': return 'T';
+    case 'C': return 'G';
+    case 'G': return 'C';
+    case 'T': return 'A';
+    default: return 'N';
+    }
+}
+
+// a merged read and the reverse complement of read2 it was built from,
+// reused from pair to pair
+struct merged_read {
+    std::string seq, qual;
+    std::string rc_seq, rc_qual;
+};
+
+// Merges the reads of a pair whose insert is shorter than the two reads
+// together into one read of the insert. Read1 is laid against the reverse
+// complement of read2 at every offset, longest overlap first, and the first
+// that overlaps by min_overlap bases with at most mismatch_percent of them
+// differing is taken. The insert ends where read2 starts, so what either
+// read has beyond it is adapter and is not kept; read2 starts before read1
+// when the insert is shorter than a read. In the overlap, agreeing bases get the higher of the
+// two qualities and disagreeing ones the base of the higher quality, with
+// the difference of the qualities.
+class read_merger {
+public:
+    read_merger(int min_overlap, int mismatch_percent): min_overlap_(min_overlap), mismatch_percent_(mismatch_percent) {}
+
+    bool merge(const char* seq1, const char* qual1, int l1, const char* seq2, const char* qual2, int l2,
+        int phred, merged_read& m) const {
+        if(l1 < min_overlap_ || l2 < min_overlap_)
+            return false;
+        m.rc_seq.resize(l2);
+        m.rc_qual.resize(l2);
+        for(int i = 0; i < l2; i++) {
+            m.rc_seq[i] = complement(seq2[l2 - 1 - i]);
+            m.rc_qual[i] = qual2[l2 - 1 - i];
+        }
+        const char* rc = m.rc_seq.data();
+        for(int offset = 0; offset <= l1 - min_overlap_; offset++) {
+            int overlap = std::min(l1 - offset, l2);
+            if(mismatches(seq1 + offset, rc, overlap, limit(overlap)) <= limit(overlap)) {
+                m.seq.assign(seq1, offset);
+                m.qual.assign(qual1, offset);
+                consensus(seq1 + offset, qual1 + offset, rc, m.rc_qual.data(), overlap, phred, m);
+                m.seq.append(rc + overlap, l2 - overlap);
+                m.qual.append(m.rc_qual, overlap, l2 - overlap);
+                return true;
+            }
+        }
+        for(int skip = 1; skip <= l2 - min_overlap_; skip++) {
+            int overlap = std::min(l1, l2 - skip);
+            if(mismatches(seq1, rc + skip, overlap, limit(overlap)) <= limit(overlap)) {
+                m.seq.clear();
+                m.qual.clear();
+                consensus(seq1, qual1, rc + skip, m.rc_qual.data() + skip, overlap, phred, m);
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    int limit(int overlap) const { return overlap * mismatch_percent_ / 100; }
+
+    static void consensus(const char* s1, const char* q1, const char* s2, const char* q2, int l, int phred, merged_read& m) {
+        size_t n = m.seq.size();
+        m.seq.resize(n + l);
+        m.qual.resize(n + l);
+        for(int i = 0; i < l; i++) {
+            bool first = q1[i] >= q2[i];
+            m.seq[n + i] = first? s1[i]: s2[i];
+            if(s1[i] == s2[i])
+                m.qual[n + i] = first? q1[i]: q2[i];
+            else
+                m.qual[n + i] = std::max(phred + 2, phred + std::abs(q1[i] - q2[i]));
+        }
+    }
+
+    int min_overlap_, mismatch_percent_;
+};
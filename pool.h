@@ -0,0 +1,85 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+#include "fastqfilter.h"
+
+// What a worker thread keeps from one job to the next: its deflate stream
+// and the scratch buffers of the filter. A job sets the level it wants.
+struct worker_state {
+    z_stream zs;
+    worker_scratch w;
+
+    worker_state() {
+        memset(&zs, 0, sizeof(zs));
+        deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    }
+    ~worker_state() { deflateEnd(&zs); }
+
+private:
+    worker_state(const worker_state&);
+    worker_state& operator=(const worker_state&);
+};
+
+// Fixed set of worker threads running the worker loops of jobs, started
+// once so that a job gets threads, deflate streams and buffers that are
+// already warm. Tasks run in the order they are submitted; a job whose
+// tasks wait behind another's starts once that one's finish.
+class worker_pool {
+public:
+    explicit worker_pool(int threads): stop_(false) {
+        for(int i = 0; i < threads; i++)
+            threads_.push_back(std::thread([this] { run(); }));
+    }
+
+    // runs the tasks submitted so far, then stops the threads
+    ~worker_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        ready_.notify_all();
+        for(size_t i = 0; i < threads_.size(); i++)
+            threads_[i].join();
+    }
+
+    int size() const { return threads_.size(); }
+
+    void submit(const std::function<void(worker_state&)>& task) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(task);
+        ready_.notify_one();
+    }
+
+private:
+    worker_pool(const worker_pool&);
+    worker_pool& operator=(const worker_pool&);
+
+    void run() {
+        worker_state state;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for(;;) {
+            ready_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            if(tasks_.empty())
+                return;
+            std::function<void(worker_state&)> task;
+            task.swap(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+            task(state);
+            lock.lock();
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::deque<std::function<void(worker_state&)>> tasks_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+};
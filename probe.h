@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <ostream>
+#include <string>
+#include "batch.h"
+#include "quality.h"
+
+// positions at the start of a read checked for an inline UMI and its spacer,
+// and the pairs needed before telling fixed bases from varied ones
+const int PROBE_POSITIONS = 32;
+const size_t PROBE_MIN_PAIRS = 100;
+
+// A run of diverse bases followed by bases that (nearly) never change is
+// how an inline UMI and its spacer look; the template after them is diverse
+// again. Finds the UMI length and spacer length of mate m, false if the
+// first reads do not look like that.
+inline bool find_inline_umi(const read_batch* b, int m, int& umi_length, int& spacer_length) {
+    size_t reads = b->pairs;
+    if(reads < PROBE_MIN_PAIRS)
+        return false;
+    uint32_t shortest = UINT32_MAX;
+    for(size_t i = 0; i < reads; i++)
+        shortest = std::min(shortest, b->seq_l[2 * i + m]);
+    int positions = std::min<int>(PROBE_POSITIONS, shortest);
+    bool conserved[PROBE_POSITIONS];
+    for(int p = 0; p < positions; p++) {
+        size_t counts[256] = {0};
+        for(size_t i = 0; i < reads; i++)
+            counts[(unsigned char)b->seq(2 * i + m)[p]]++;
+        conserved[p] = *std::max_element(counts, counts + 256) * 10 >= reads * 9;
+    }
+    int p = 0;
+    while(p < positions && !conserved[p]) p++;
+    int q = p;
+    while(q < positions && conserved[q]) q++;
+    if(p < 4 || p == positions || q == positions)
+        return false;
+    umi_length = p;
+    spacer_length = q - p;
+    return true;
+}
+
+// name without a trailing /1 or /2
+inline std::string mate_name(const char* name, size_t l) {
+    if(l >= 2 && name[l - 2] == '/' && (name[l - 1] == '1' || name[l - 1] == '2'))
+        l -= 2;
+    return std::string(name, l);
+}
+
+// true if s is 4 to 64 bases, possibly split by _, + or -, as a UMI
+// in a read name is
+inline bool looks_like_umi(const char* s, size_t l) {
+    size_t bases = 0;
+    for(size_t i = 0; i < l; i++) {
+        if(strchr("ACGTN", s[i]))
+            bases++;
+        else if(!strchr("_+-", s[i]))
+            return false;
+    }
+    return bases >= 4 && bases <= 64;
+}
+
+// Prints what the first pairs of the inputs tell about them and the options
+// that fit them.
+inline void probe_pairs(const read_batch* b, bool complete, std::ostream& out) {
+    size_t pairs = b->pairs;
+    out << "pairs probed: " << pairs << (complete? " (the whole input)": "") << "\n";
+    if(!pairs)
+        return;
+    int min_qual = 255, max_qual = 0;
+    for(int m = 0; m < 2; m++) {
+        std::map<uint32_t, size_t> lengths;
+        for(size_t i = 0; i < pairs; i++) {
+            size_t r = 2 * i + m;
+            lengths[b->seq_l[r]]++;
+            const unsigned char* q = (const unsigned char*)b->qual(r);
+            for(uint32_t j = 0; j < b->seq_l[r]; j++) {
+                min_qual = std::min<int>(min_qual, q[j]);
+                max_qual = std::max<int>(max_qual, q[j]);
+            }
+        }
+        uint32_t common = 0;
+        size_t most = 0;
+        for(std::map<uint32_t, size_t>::const_iterator l = lengths.begin(); l != lengths.end(); ++l)
+            if(l->second > most) {
+                most = l->second;
+                common = l->first;
+            }
+        out << "read" << m + 1 << " length: " << lengths.begin()->first << " to " << lengths.rbegin()->first
+            << ", mostly " << common << "\n";
+    }
+    int phred = detect_phred(min_qual, max_qual);
+    out << "qualities: '" << (char)min_qual << "' to '" << (char)max_qual << "', Phred+" << phred << "\n";
+
+    size_t same_names = 0, umi_names = 0, illumina = 0, dual = 0;
+    std::map<std::string, size_t> indexes;
+    for(size_t i = 0; i < pairs; i++) {
+        size_t r1 = 2 * i, r2 = r1 + 1;
+        same_names += mate_name(b->name(r1), b->name_l[r1]) == mate_name(b->name(r2), b->name_l[r2]);
+        const char* name = b->name(r1);
+        const char* colon = (const char*)memrchr(name, ':', b->name_l[r1]);
+        if(colon)
+            umi_names += looks_like_umi(colon + 1, name + b->name_l[r1] - colon - 1);
+        const char* comment = b->comment(r1);
+        size_t comment_l = b->comment_l[r1];
+        if(comment_l > 6 && comment[0] == '1' && comment[1] == ':' && (comment[2] == 'N' || comment[2] == 'Y')) {
+            illumina++;
+            const char* index = (const char*)memrchr(comment, ':', comment_l) + 1;
+            std::string barcode(index, comment + comment_l - index);
+            dual += barcode.find('+') != std::string::npos;
+            indexes[barcode]++;
+        }
+    }
+    out << "pairing: names of read1 and read2 agree in " << same_names << " of " << pairs << " pairs"
+        << (same_names == pairs? "": ", the inputs may not be mates") << "\n";
+    if(illumina) {
+        out << "index: Illumina comments in " << illumina << " pairs, " << (dual * 2 > illumina? "dual": "single")
+            << " index, " << indexes.size() << " distinct";
+        std::vector<std::pair<size_t, std::string> > top;
+        for(std::map<std::string, size_t>::const_iterator i = indexes.begin(); i != indexes.end(); ++i)
+            top.push_back(std::make_pair(i->second, i->first));
+        std::sort(top.rbegin(), top.rend());
+        for(size_t i = 0; i < top.size() && i < 3; i++)
+            out << (i? ", ": ", most common ") << top[i].second << " (" << top[i].first << ")";
+        out << "\n";
+    }
+    if(umi_names * 10 >= pairs * 9)
+        out << "umi: read names already end in a UMI\n";
+
+    int umi[2], spacer[2];
+    bool found[2];
+    for(int m = 0; m < 2; m++) {
+        found[m] = find_inline_umi(b, m, umi[m], spacer[m]);
+        if(found[m])
+            out << "umi: read" << m + 1 << " starts with " << umi[m] << " varied bases and a spacer of "
+                << spacer[m] << " fixed\n";
+    }
+    if(!found[0] && !found[1]) {
+        out << "umi: no inline UMI found\n";
+        out << "suggested: --phred " << phred << "\n";
+        return;
+    }
+    out << "suggested: --phred " << phred;
+    if(found[0] && found[1] && umi[0] == umi[1] && spacer[0] == spacer[1])
+        out << " --umi --umiStart 0 --umiLength " << umi[0] << " --readStart " << umi[0] + spacer[0] << "\n"
+            << "       or: --phred " << phred;
+    for(int m = 0; m < 2; m++)
+        if(found[m])
+            out << " --structure" << m + 1 << " " << umi[m] << "M" << spacer[m] << "S+T";
+    out << "\n";
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#endif
+
+// Guesses the Phred offset from the range of quality characters seen:
+// anything below ';' only exists in Phred+33, anything above 'J' only in
+// Phred+64. Inputs inside both ranges are taken as the far more common +33.
+inline int detect_phred(int min_qual, int max_qual) {
+    if(min_qual < ';')
+        return 33;
+    if(max_qual > 'J')
+        return 64;
+    return 33;
+}
+
+// Illumina style quality binning, 8 levels as on HiSeq X and 4 as on NovaSeq
+inline int bin_phred(int q, int levels) {
+    if(levels == 8) {
+        if(q < 2) return q;
+        if(q < 10) return 6;
+        if(q < 20) return 15;
+        if(q < 25) return 22;
+        if(q < 30) return 27;
+        if(q < 35) return 33;
+        if(q < 40) return 37;
+        return 40;
+    }
+    if(levels == 4) {
+        if(q < 3) return 2;
+        if(q < 15) return 11;
+        if(q < 31) return 25;
+        return 37;
+    }
+    return q;
+}
+
+struct quality_bins;
+typedef void (*bin_function)(char* dst, const char* src, int length, const quality_bins& b);
+
+// Lookup tables for one binning scheme at one Phred offset. Qualities above
+// 63 fall into the top bin, characters below the offset into the lowest.
+struct quality_bins {
+    int levels;
+    int offset;
+    unsigned char lut[256];
+    unsigned char nibble[4][16];  // phred >> 4 selects the table, phred & 15 the entry
+    bin_function apply;
+
+    quality_bins(): levels(0), offset(33), apply(nullptr) {}
+    quality_bins(int levels, int offset);
+};
+
+inline void bin_quality_scalar(char* dst, const char* src, int length, const quality_bins& b) {
+    for(int i = 0; i < length; i++)
+        dst[i] = b.lut[(unsigned char)src[i]];
+}
+
+#ifdef __SSE2__
+// sixteen qualities per step through four pshufb lookups, one per high nibble
+__attribute__((target("ssse3")))
+inline void bin_quality_ssse3(char* dst, const char* src, int length, const quality_bins& b) {
+    const __m128i offset = _mm_set1_epi8(b.offset), top = _mm_set1_epi8(63), low = _mm_set1_epi8(15);
+    __m128i table[4], select[4];
+    for(int h = 0; h < 4; h++) {
+        table[h] = _mm_loadu_si128((const __m128i*)b.nibble[h]);
+        select[h] = _mm_set1_epi8(h);
+    }
+    int i = 0;
+    for(; i + 16 <= length; i += 16) {
+        __m128i q = _mm_min_epu8(_mm_subs_epu8(_mm_loadu_si128((const __m128i*)(src + i)), offset), top);
+        __m128i lo = _mm_and_si128(q, low);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(q, 4), low);
+        __m128i r = _mm_setzero_si128();
+        for(int h = 0; h < 4; h++)
+            r = _mm_or_si128(r, _mm_and_si128(_mm_cmpeq_epi8(hi, select[h]), _mm_shuffle_epi8(table[h], lo)));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi8(r, offset));
+    }
+    bin_quality_scalar(dst + i, src + i, length - i, b);
+}
+#endif
+
+inline quality_bins::quality_bins(int levels, int offset): levels(levels), offset(offset) {
+    for(int c = 0; c < 256; c++) {
+        int q = c < offset? 0: c - offset > 63? 63: c - offset;
+        lut[c] = bin_phred(q, levels) + offset;
+    }
+    for(int q = 0; q < 64; q++)
+        nibble[q >> 4][q & 15] = bin_phred(q, levels);
+    apply = bin_quality_scalar;
+#ifdef __SSE2__
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3"))
+        apply = bin_quality_ssse3;
+#endif
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include "screen.h"
+
+// What --reorder orders the pairs of a batch by before they are formatted.
+// In input order, reads of one amplicon or molecule are scattered over the
+// output, so deflate rarely finds one in its 32 KB window when it comes to
+// the next; sorted by a key shared by such reads they sit side by side.
+enum reorder_key { REORDER_NONE, REORDER_MINIMIZER, REORDER_UMI };
+
+// k of the minimizer of read1, short enough that a sequencing error leaves
+// most k-mers of a read intact
+const int MINIMIZER_K = 15;
+
+// the smallest hash of the canonical k-mers of seq without an N, which
+// reads of one locus mostly agree on whichever strand they are from; ~0
+// when there is none
+inline uint64_t minimizer(const char* seq, size_t l, int k) {
+    static const base_code codes(true);
+    uint64_t mask = (1ULL << (2 * k)) - 1, forward = 0, reverse = 0, least = ~0ULL;
+    int shift = 2 * (k - 1), valid = 0;
+    for(size_t i = 0; i < l; i++) {
+        uint64_t code = codes.code[(unsigned char)seq[i]];
+        if(code > 3) {
+            valid = 0;
+            continue;
+        }
+        forward = ((forward << 2) | code) & mask;
+        reverse = (reverse >> 2) | ((3 - code) << shift);
+        if(++valid >= k)
+            least = std::min(least, kmer_hash(std::min(forward, reverse)));
+    }
+    return least;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "kseq.h"
+
+// Seeded 64-bit hash of a read name, FNV-1a with a splitmix finisher. A
+// trailing /1 or /2 is ignored so that both mates of a pair hash the same.
+inline uint64_t name_hash(const char* name, size_t l, uint64_t seed) {
+    if(l >= 2 && name[l - 2] == '/' && (name[l - 1] == '1' || name[l - 1] == '2'))
+        l -= 2;
+    uint64_t h = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+    for(size_t i = 0; i < l; i++)
+        h = (h ^ (unsigned char)name[i]) * 0x100000001b3ULL;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+// What the reader takes from the inputs: a fraction of the pairs chosen by
+// the hash of their name, so the same pairs are taken on every run with the
+// same seed, and at most max_pairs of them.
+class read_limits {
+public:
+    read_limits(): seed_(0), threshold_(0), sample_(false), max_pairs_(UINT64_MAX), taken_(0) {}
+
+    void set_fraction(double fraction, uint64_t seed) {
+        seed_ = seed;
+        sample_ = fraction < 1;
+        threshold_ = sample_? (uint64_t)(fraction * 18446744073709551616.0): UINT64_MAX;
+    }
+
+    void set_max_pairs(uint64_t n) { max_pairs_ = n; }
+
+    bool exhausted() const { return taken_ >= max_pairs_; }
+
+    // whether the pair whose read1 is named name is taken, counting it if so
+    bool take(const kstring_t* name) {
+        if(sample_ && name_hash(name->s, name->l, seed_) >= threshold_)
+            return false;
+        taken_++;
+        return true;
+    }
+
+private:
+    uint64_t seed_, threshold_;
+    bool sample_;
+    uint64_t max_pairs_, taken_;
+};
+
+// Exactly k pairs drawn uniformly from all the pairs offered: the k with the
+// smallest name hash (bottom-k sampling). Being a function of the names only,
+// the sample does not depend on the order batches finish in. Workers read
+// threshold() to drop pairs that can no longer get in before formatting them;
+// offer() is called from the writer thread only.
+class pair_reservoir {
+public:
+    struct entry {
+        uint64_t hash;
+        uint64_t order;  // batch id above the position in the batch
+        std::string text[2];
+    };
+
+    explicit pair_reservoir(size_t k): k_(k), threshold_(UINT64_MAX) {}
+
+    // pairs hashing to this or above are not taken any more
+    uint64_t threshold() const { return threshold_.load(std::memory_order_relaxed); }
+
+    void offer(uint64_t hash, uint64_t order, const char* text1, size_t l1, const char* text2, size_t l2) {
+        if(hash >= threshold())
+            return;
+        if(heap_.size() == k_) {
+            std::pop_heap(heap_.begin(), heap_.end(), by_hash);
+            heap_.pop_back();
+        }
+        entry e;
+        e.hash = hash;
+        e.order = order;
+        e.text[0].assign(text1, l1);
+        e.text[1].assign(text2, l2);
+        heap_.push_back(std::move(e));
+        std::push_heap(heap_.begin(), heap_.end(), by_hash);
+        if(heap_.size() == k_)
+            threshold_.store(heap_.front().hash, std::memory_order_relaxed);
+    }
+
+    // the pairs taken, in input order
+    std::vector<entry>& sorted() {
+        std::sort(heap_.begin(), heap_.end(), [](const entry& a, const entry& b) { return a.order < b.order; });
+        return heap_;
+    }
+
+private:
+    static bool by_hash(const entry& a, const entry& b) { return a.hash < b.hash; }
+
+    size_t k_;
+    std::vector<entry> heap_;  // max-heap on the hash
+    std::atomic<uint64_t> threshold_;
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fqb.h"
+
+// A filter saved with --screen-save is a 64 byte header and the blocks as
+// they sit in memory, so that it is mapped instead of read:
+//
+//   header := "FQBL" | u32 k | u64 blocks | 48 zero bytes
+const char SCREEN_MAGIC[4] = {'F', 'Q', 'B', 'L'};
+const size_t SCREEN_HEADER = 64;
+
+// murmur3's finalizer, spreading the 2-bit code of a k-mer over all 64 bits
+inline uint64_t kmer_hash(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    return x ^ (x >> 33);
+}
+
+// Blocked Bloom filter of the canonical k-mers of reference sequences. Every
+// k-mer sets PROBES bits of one 64 byte block, so a lookup touches a single
+// cache line. k-mers are rolled along a read two bits a base, forward and
+// reverse complement at once, and an N starts over. The blocks are built in
+// memory from the reference or mapped from a file it was saved to, where
+// they are paged in as reads touch them.
+class kmer_screen {
+public:
+    kmer_screen(): k_(0), blocks_(0), words_(nullptr), map_(MAP_FAILED), map_size_(0) {}
+    ~kmer_screen() { unmap(); }
+
+    // sized for kmers k-mers at BITS_PER_KMER bits each
+    void reset(int k, uint64_t kmers) {
+        unmap();
+        k_ = k;
+        blocks_ = std::max<uint64_t>(1, (kmers * BITS_PER_KMER + 511) / 512);
+        owned_.assign(blocks_ * 8 + 7, 0);
+        uint64_t* p = owned_.data();
+        while((uintptr_t)p % 64) p++;
+        words_ = p;
+    }
+
+    void add(const char* seq, size_t l) {
+        uint64_t* words = const_cast<uint64_t*>(words_);
+        roll(seq, l, [&](uint64_t kmer) {
+            uint64_t h = kmer_hash(kmer);
+            uint64_t* block = words + block_of(h) * 8;
+            for(int p = 0; p < PROBES; p++, h >>= 9)
+                block[(h >> 6) & 7] |= 1ULL << (h & 63);
+        });
+    }
+
+    // k-mers of seq added to kmers, those in the filter to hits. The blocks
+    // of a run of k-mers are prefetched before any is tested, so that their
+    // cache misses overlap instead of following one another.
+    void count(const char* seq, size_t l, int& kmers, int& hits) const {
+        uint64_t hash[RUN];
+        int n = 0;
+        roll(seq, l, [&](uint64_t kmer) {
+            hash[n] = kmer_hash(kmer);
+            __builtin_prefetch(words_ + block_of(hash[n]) * 8);
+            if(++n == RUN) {
+                hits += contains(hash, n);
+                n = 0;
+            }
+            kmers++;
+        });
+        hits += contains(hash, n);
+    }
+
+    int k() const { return k_; }
+    uint64_t bytes() const { return blocks_ * 64; }
+
+    bool save(const std::string& path, std::string& error) const {
+        std::string header(SCREEN_MAGIC, 4);
+        put_u32(header, k_);
+        put_u64(header, blocks_);
+        header.resize(SCREEN_HEADER, '\0');
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = fd >= 0 && write_all(fd, header.data(), SCREEN_HEADER) && write_all(fd, (const char*)words_, bytes());
+        if(!ok)
+            error = "can not write " + path + ": " + strerror(errno);
+        if(fd >= 0 && close(fd) && ok) {
+            error = "can not write " + path + ": " + strerror(errno);
+            ok = false;
+        }
+        return ok;
+    }
+
+    // maps a saved filter, false with error empty if path is not one
+    bool load(const std::string& path, std::string& error) {
+        error.clear();
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            error = "can not open " + path + ": " + strerror(errno);
+            return false;
+        }
+        char header[SCREEN_HEADER];
+        struct stat st;
+        if(fstat(fd, &st) || st.st_size < (off_t)SCREEN_HEADER || pread(fd, header, SCREEN_HEADER, 0) != (ssize_t)SCREEN_HEADER ||
+           memcmp(header, SCREEN_MAGIC, 4)) {
+            close(fd);
+            return false;
+        }
+        int k = get_uint(header + 4, 4);
+        uint64_t blocks = get_uint(header + 8, 8);
+        if(k < 1 || k > 32 || !blocks || (uint64_t)st.st_size != SCREEN_HEADER + blocks * 64) {
+            close(fd);
+            error = path + " is not a complete screen filter";
+            return false;
+        }
+        void* map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(map == MAP_FAILED) {
+            error = "can not map " + path + ": " + strerror(errno);
+            return false;
+        }
+        unmap();
+        owned_.clear();
+        map_ = map;
+        map_size_ = st.st_size;
+        k_ = k;
+        blocks_ = blocks;
+        words_ = (const uint64_t*)((const char*)map + SCREEN_HEADER);
+        return true;
+    }
+
+private:
+    static const int PROBES = 6;
+    static const int BITS_PER_KMER = 16;  // about 0.1% false hits
+    static const int RUN = 32;  // k-mers prefetched at a time
+
+    kmer_screen(const kmer_screen&);
+    kmer_screen& operator=(const kmer_screen&);
+
+    // calls f with the canonical code of every k-mer of seq without an N
+    template <class F>
+    void roll(const char* seq, size_t l, F f) const {
+        static const base_code codes(true);
+        uint64_t mask = k_ == 32? ~0ULL: (1ULL << (2 * k_)) - 1;
+        int shift = 2 * (k_ - 1);
+        uint64_t forward = 0, reverse = 0;
+        int valid = 0;
+        for(size_t i = 0; i < l; i++) {
+            uint64_t code = codes.code[(unsigned char)seq[i]];
+            if(code > 3) {
+                valid = 0;
+                continue;
+            }
+            forward = ((forward << 2) | code) & mask;
+            reverse = (reverse >> 2) | ((3 - code) << shift);
+            if(++valid >= k_)
+                f(std::min(forward, reverse));
+        }
+    }
+
+    // how many of the n hashes are in the filter
+    int contains(const uint64_t* hash, int n) const {
+        int in = 0;
+        for(int i = 0; i < n; i++) {
+            uint64_t h = hash[i];
+            const uint64_t* block = words_ + block_of(h) * 8;
+            bool all = true;
+            for(int p = 0; p < PROBES; p++, h >>= 9)
+                all &= (block[(h >> 6) & 7] >> (h & 63)) & 1;
+            in += all;
+        }
+        return in;
+    }
+
+    // the high bits pick the block, the low 54 the bits within it
+    uint64_t block_of(uint64_t h) const { return (uint64_t)(((unsigned __int128)h * blocks_) >> 64); }
+
+    static bool write_all(int fd, const char* p, size_t l) {
+        while(l) {
+            ssize_t n = write(fd, p, l);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                return false;
+            p += n;
+            l -= n;
+        }
+        return true;
+    }
+
+    void unmap() {
+        if(map_ != MAP_FAILED)
+            munmap(map_, map_size_);
+        map_ = MAP_FAILED;
+    }
+
+    int k_;
+    uint64_t blocks_;
+    std::vector<uint64_t> owned_;  // built in memory, aligned to a block within
+    const uint64_t* words_;
+    void* map_;
+    size_t map_size_;
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// A job for --serve comes over a Unix socket as the working directory of
+// the client and its arguments, and is answered with the job's exit status
+// and messages once it is done, on the same connection:
+//
+//   request  := u32 count | u32 bytes | count NUL terminated strings in
+//               those bytes: the directory, then argv
+//   response := i32 status | u32 length | the messages
+//
+// Both ends are on one host, so the integers are in its byte order.
+const uint32_t SERVE_MAX_REQUEST = 1 << 20;
+
+// runs a request, writing what the job reports to log, and returns its status
+typedef std::function<int(const std::vector<std::string>& request, std::ostream& log)> job_runner;
+
+inline bool socket_read(int fd, void* p, size_t l) {
+    char* s = (char*)p;
+    while(l) {
+        ssize_t n = recv(fd, s, l, 0);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        s += n;
+        l -= n;
+    }
+    return true;
+}
+
+// a client gone away fails the send instead of raising SIGPIPE
+inline bool socket_write(int fd, const void* p, size_t l) {
+    const char* s = (const char*)p;
+    while(l) {
+        ssize_t n = send(fd, s, l, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        s += n;
+        l -= n;
+    }
+    return true;
+}
+
+inline bool socket_address(const std::string& path, sockaddr_un& addr, std::string& error) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) {
+        error = "socket path " + path + " is too long";
+        return false;
+    }
+    memcpy(addr.sun_path, path.data(), path.size());
+    return true;
+}
+
+// Jobs admitted and not finished yet. Each opens its files and allocates
+// its batches as soon as it starts, even while its tasks wait for the
+// workers, so the daemon stops accepting at a limit and leaves the
+// connections beyond it waiting in the listen backlog.
+class job_slots {
+public:
+    explicit job_slots(int limit): free_(limit) {}
+
+    void acquire() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        freed_.wait(lock, [this] { return free_ > 0; });
+        free_--;
+    }
+
+    void release() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_++;
+        freed_.notify_one();
+    }
+
+private:
+    int free_;
+    std::mutex mutex_;
+    std::condition_variable freed_;
+};
+
+// reads a request and answers it
+inline void serve_request(int fd, uint64_t id, const job_runner& run) {
+    uint32_t count = 0, bytes = 0;
+    std::vector<std::string> request;
+    std::string strings;
+    bool ok = socket_read(fd, &count, 4) && socket_read(fd, &bytes, 4) && bytes <= SERVE_MAX_REQUEST;
+    if(ok) {
+        strings.resize(bytes);
+        ok = bytes && socket_read(fd, &strings[0], bytes) && strings[bytes - 1] == '\0';
+    }
+    for(size_t at = 0; ok && at < strings.size(); at = strings.find('\0', at) + 1)
+        request.push_back(strings.c_str() + at);
+    if(!ok || request.size() != count || count < 2) {
+        close(fd);
+        return;
+    }
+    std::ostringstream log;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int32_t status = run(request, log);
+    std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+    log << "job " << id << ": status " << status << " in " << took.count() << " s" << std::endl;
+    std::string messages = log.str();
+    uint32_t length = messages.size();
+    if(socket_write(fd, &status, 4) && socket_write(fd, &length, 4))
+        socket_write(fd, messages.data(), length);
+    close(fd);
+}
+
+// runs a connection on a thread of its own, in a slot taken for it
+inline void serve_connection(int fd, uint64_t id, const job_runner& run, job_slots& slots) {
+    serve_request(fd, id, run);
+    slots.release();
+}
+
+// Accepts jobs on the socket at path until the process is stopped, running
+// up to jobs of them at once; they share whatever run shares between them.
+inline int serve(const std::string& path, const job_runner& run, int jobs, std::ostream& log) {
+    sockaddr_un addr;
+    std::string error;
+    if(!socket_address(path, addr, error)) {
+        log << "Error: " << error << std::endl;
+        return -1;
+    }
+    struct stat st;
+    if(stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+        log << "Error: can not listen on " << path << ": " << strerror(errno) << std::endl;
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+    log << "serving jobs on " << path << std::endl;
+    job_slots slots(jobs);
+    for(uint64_t id = 1; ; ) {
+        slots.acquire();
+        int c = accept(fd, nullptr, nullptr);
+        if(c < 0) {
+            slots.release();
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            log << "Error: accepting on " << path << ": " << strerror(errno) << std::endl;
+            close(fd);
+            return -1;
+        }
+        std::thread(serve_connection, c, id++, std::cref(run), std::ref(slots)).detach();
+    }
+}
+
+// Sends a request to the daemon at path, writes the messages of the job to
+// log and returns its status.
+inline int submit(const std::string& path, const std::vector<std::string>& request, std::ostream& log) {
+    sockaddr_un addr;
+    std::string error;
+    if(!socket_address(path, addr, error)) {
+        log << "Error: " << error << std::endl;
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        log << "Error: can not connect to " << path << ": " << strerror(errno) << std::endl;
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+    std::string strings;
+    for(size_t i = 0; i < request.size(); i++)
+        strings.append(request[i].c_str(), request[i].size() + 1);
+    uint32_t count = request.size(), bytes = strings.size();
+    bool ok = socket_write(fd, &count, 4) && socket_write(fd, &bytes, 4) && socket_write(fd, strings.data(), bytes);
+    int32_t status = -1;
+    uint32_t length = 0;
+    std::string messages;
+    ok = ok && socket_read(fd, &status, 4) && socket_read(fd, &length, 4);
+    if(ok) {
+        messages.resize(length);
+        ok = !length || socket_read(fd, &messages[0], length);
+    }
+    close(fd);
+    if(!ok) {
+        log << "Error: the daemon at " << path << " did not answer" << std::endl;
+        return -1;
+    }
+    log << messages;
+    return status;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <vector>
+
+// A read structure describes a read as a run of segments, each a length and
+// an operator: T template, M molecular barcode (UMI), B sample barcode and
+// S skip. A '+' in place of the length takes the rest of the read and may
+// only be used on the last segment, e.g. 8M12S+T or 6B+T.
+struct read_segment {
+    int start, length;
+};
+
+// The structure compiled to offsets, so extracting a record costs no parsing.
+// UMI and barcode segments are concatenated in the order they appear.
+struct read_plan {
+    std::vector<read_segment> umi, barcode;
+    int template_start, template_length;  // template_length 0 runs to the end
+    int min_length;  // shorter reads can not hold the structure
+
+    read_plan(): template_start(0), template_length(0), min_length(1) {}
+
+    int umi_length() const { return total(umi); }
+    int barcode_length() const { return total(barcode); }
+
+    // the plan the old --umiStart/--umiLength/--readStart/--readLength
+    // options describe, where the UMI may overlap the template
+    static read_plan offsets(int umi_start, int umi_length, int seq_start, int seq_length) {
+        read_plan p;
+        if(umi_length) {
+            read_segment s = {umi_start, umi_length};
+            p.umi.push_back(s);
+        }
+        p.template_start = seq_start;
+        p.template_length = seq_length;
+        p.min_length = std::max(umi_start + umi_length, seq_start + (seq_length? seq_length: 1));
+        return p;
+    }
+
+private:
+    static int total(const std::vector<read_segment>& segments) {
+        int n = 0;
+        for(size_t i = 0; i < segments.size(); i++) n += segments[i].length;
+        return n;
+    }
+};
+
+// false with a message in error if spec is not a read structure
+inline bool compile_structure(const std::string& spec, read_plan& plan, std::string& error) {
+    plan = read_plan();
+    int offset = 0, templates = 0;
+    bool rest = false;
+    for(size_t i = 0; i < spec.size(); ) {
+        if(rest) {
+            error = "'+' must be the last segment of " + spec;
+            return false;
+        }
+        int length = 0;
+        if(spec[i] == '+') {
+            rest = true;
+            i++;
+        } else {
+            size_t digits = i;
+            for(; i < spec.size() && isdigit((unsigned char)spec[i]); i++) {
+                length = 10 * length + (spec[i] - '0');
+                if(length > 1 << 20) {
+                    error = "segment too long in " + spec;
+                    return false;
+                }
+            }
+            if(i == digits || length == 0) {
+                error = "expected a length or '+' at position " + std::to_string(digits) + " of " + spec;
+                return false;
+            }
+        }
+        if(i == spec.size()) {
+            error = "missing operator at the end of " + spec;
+            return false;
+        }
+        read_segment s = {offset, length};
+        switch(spec[i++]) {
+            case 'T':
+                templates++;
+                plan.template_start = offset;
+                plan.template_length = length;
+                break;
+            case 'M':
+            case 'B':
+                if(rest) {
+                    error = "UMI and barcode segments need a fixed length in " + spec;
+                    return false;
+                }
+                (spec[i - 1] == 'M'? plan.umi: plan.barcode).push_back(s);
+                break;
+            case 'S':
+                break;
+            default:
+                error = std::string("unknown operator ") + spec[i - 1] + " in " + spec + ", use T, M, B or S";
+                return false;
+        }
+        offset += length;
+    }
+    if(templates != 1) {
+        error = "a read structure needs exactly one template segment, " + spec + " has " + std::to_string(templates);
+        return false;
+    }
+    plan.min_length = offset + (plan.template_length? 0: 1);
+    return true;
+}
+
+// copies the segments of a read back to back onto out
+inline void append_segments(std::string& out, const std::vector<read_segment>& segments, const char* seq) {
+    for(size_t i = 0; i < segments.size(); i++)
+        out.append(seq + segments[i].start, segments[i].length);
+}
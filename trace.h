@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// one span of a stage on a batch, or a sample of a counter
+struct trace_event {
+    const char* name;  // a literal
+    uint64_t start, duration;  // ns since the tracer started
+    int64_t value;  // the batch of a span, the value of a counter
+    bool counter;
+};
+
+// The events of one thread, written by that thread only. The newest
+// CAPACITY events are kept; the head is published with a release store so
+// that a reader on another thread sees whole events, and the thread never
+// waits for anyone.
+class trace_ring {
+public:
+    trace_ring(const std::string& name, std::chrono::steady_clock::time_point origin):
+        name_(name), origin_(origin), events_(new trace_event[CAPACITY]), head_(0) {}
+
+    uint64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin_).count();
+    }
+
+    // stage name on batch from start to now
+    void span(const char* name, uint64_t batch, uint64_t start) {
+        trace_event e = {name, start, now() - start, (int64_t)batch, false};
+        push(e);
+    }
+
+    void counter(const char* name, int64_t value) {
+        trace_event e = {name, now(), 0, value, true};
+        push(e);
+    }
+
+    const std::string& name() const { return name_; }
+    uint64_t written() const { return head_.load(std::memory_order_acquire); }
+    // the i-th event written, of the last CAPACITY
+    const trace_event& at(uint64_t i) const { return events_[i % CAPACITY]; }
+    uint64_t first() const { uint64_t n = written(); return n > CAPACITY? n - CAPACITY: 0; }
+
+private:
+    static const uint64_t CAPACITY = 1 << 16;
+
+    void push(const trace_event& e) {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        events_[head % CAPACITY] = e;
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+    std::string name_;
+    std::chrono::steady_clock::time_point origin_;
+    std::unique_ptr<trace_event[]> events_;
+    std::atomic<uint64_t> head_;
+};
+
+// The rings of every thread of the pipeline, all made before the threads
+// start, written out as a Chrome trace (chrome://tracing, ui.perfetto.dev)
+// once they are done: a track per thread with a span per batch and stage,
+// and the queue depths as counters.
+class tracer {
+public:
+    tracer(): origin_(std::chrono::steady_clock::now()) {}
+
+    trace_ring* thread(const std::string& name) {
+        rings_.push_back(std::unique_ptr<trace_ring>(new trace_ring(name, origin_)));
+        return rings_.back().get();
+    }
+
+    bool write(const std::string& path, uint64_t& dropped) const {
+        std::ofstream out(path.c_str());
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"filter\"}}";
+        dropped = 0;
+        for(size_t t = 0; t < rings_.size(); t++) {
+            const trace_ring& r = *rings_[t];
+            out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t + 1
+                << ",\"args\":{\"name\":\"" << r.name() << "\"}}";
+            dropped += r.first();
+            for(uint64_t i = r.first(); i < r.written(); i++) {
+                const trace_event& e = r.at(i);
+                out << ",\n{\"name\":\"" << e.name << "\",\"pid\":1,\"tid\":" << t + 1 << ",\"ts\":" << microseconds(e.start);
+                if(e.counter)
+                    out << ",\"ph\":\"C\",\"args\":{\"batches\":" << e.value << "}}";
+                else
+                    out << ",\"ph\":\"X\",\"dur\":" << microseconds(e.duration) << ",\"args\":{\"batch\":" << e.value << "}}";
+            }
+        }
+        out << "\n]}\n";
+        out.close();
+        return !out.fail();
+    }
+
+private:
+    static std::string microseconds(uint64_t ns) {
+        std::string s = std::to_string(ns / 1000) + ".000";
+        uint64_t frac = ns % 1000;
+        for(int i = 0; i < 3; i++, frac /= 10)
+            s[s.size() - 1 - i] = '0' + frac % 10;
+        return s;
+    }
+
+    std::chrono::steady_clock::time_point origin_;
+    std::vector<std::unique_ptr<trace_ring>> rings_;
+};
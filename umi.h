@@ -0,0 +1,347 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// 2-bit code of a UMI with a leading 1 bit marking its length, so UMIs of up
+// to 31 bases fit one word and ~0 is never a key. false for non-ACGT bases.
+inline bool encode_umi(const char* s, int length, uint64_t& key) {
+    key = 1;
+    for(int i = 0; i < length; i++) {
+        uint64_t code;
+        switch(s[i]) {
+            case 'A': code = 0; break;
+            case 'C': code = 1; break;
+            case 'G': code = 2; break;
+            case 'T': code = 3; break;
+            default: return false;
+        }
+        key = key << 2 | code;
+    }
+    return true;
+}
+
+inline void decode_umi(uint64_t key, int length, char* s) {
+    static const char letters[4] = {'A', 'C', 'G', 'T'};
+    for(int i = length - 1; i >= 0; i--, key >>= 2)
+        s[i] = letters[key & 3];
+}
+
+// Open addressing map from UMI keys to 32-bit values with linear probing. It
+// doubles while below max_size entries and refuses new keys beyond that, so
+// memory stays bounded however many distinct UMIs the input has.
+class umi_table {
+public:
+    explicit umi_table(size_t max_size = 0): size_(0), max_size_(max_size) { rehash(1024); }
+
+    size_t size() const { return size_; }
+
+    const uint32_t* find(uint64_t key) const {
+        for(size_t i = slot(key); ; i = (i + 1) & mask_) {
+            if(keys_[i] == key) return &values_[i];
+            if(keys_[i] == EMPTY) return nullptr;
+        }
+    }
+
+    // the value of key, inserted as value if missing; nullptr when full
+    uint32_t* insert(uint64_t key, uint32_t value) {
+        size_t i = slot(key);
+        for(; keys_[i] != EMPTY; i = (i + 1) & mask_)
+            if(keys_[i] == key) return &values_[i];
+        if(max_size_ && size_ >= max_size_) return nullptr;
+        if(2 * (size_ + 1) > keys_.size()) {
+            rehash(2 * keys_.size());
+            return insert(key, value);
+        }
+        keys_[i] = key;
+        values_[i] = value;
+        size_++;
+        return &values_[i];
+    }
+
+    template <typename F>
+    void for_each(F f) const {
+        for(size_t i = 0; i < keys_.size(); i++)
+            if(keys_[i] != EMPTY) f(keys_[i], values_[i]);
+    }
+
+private:
+    static const uint64_t EMPTY = ~(uint64_t)0;
+
+    size_t slot(uint64_t key) const { return (key * 0x9e3779b97f4a7c15ULL >> 20) & mask_; }
+
+    void rehash(size_t slots) {
+        std::vector<uint64_t> keys(slots, EMPTY);
+        std::vector<uint32_t> values(slots);
+        keys.swap(keys_);
+        values.swap(values_);
+        mask_ = slots - 1;
+        size_ = 0;
+        for(size_t i = 0; i < keys.size(); i++)
+            if(keys[i] != EMPTY) insert(keys[i], values[i]);
+    }
+
+    std::vector<uint64_t> keys_;
+    std::vector<uint32_t> values_;
+    size_t mask_, size_, max_size_;
+};
+
+// Maps a set of keys and, with mismatches allowed, each of their
+// one-substitution neighbours back to the key. Neighbours of two keys match
+// neither. One base other than ACGT counts as a mismatch.
+class neighbour_index {
+public:
+    neighbour_index(): length_(0), mismatches_(false) {}
+
+    void build(const std::vector<uint64_t>& keys, int length, bool mismatches) {
+        keys_ = keys;
+        length_ = length;
+        mismatches_ = mismatches;
+        table_ = umi_table();
+        for(size_t i = 0; i < keys.size(); i++)
+            *table_.insert(keys[i], i) = i;
+        if(mismatches)
+            for(size_t i = 0; i < keys.size(); i++)
+                for_each_neighbour(keys[i], length, [&](uint64_t n) {
+                    uint32_t* v = table_.insert(n, i);
+                    if(*v != i && *v != AMBIGUOUS && keys_[*v] != n)
+                        *v = AMBIGUOUS;
+                });
+    }
+
+    size_t size() const { return keys_.size(); }
+    int length() const { return length_; }
+    uint64_t key(size_t i) const { return keys_[i]; }
+
+    // index of the key s of length() bases matches, -1 for none. An N is
+    // the one mismatch allowed, so the rest of s has to match exactly: only
+    // the four keys with a base in its place are tried, never the table of
+    // neighbours.
+    int find(const char* s, bool& exact) const {
+        uint64_t key = 1;
+        int n = -1;
+        for(int i = 0; i < length_; i++) {
+            uint64_t code;
+            switch(s[i]) {
+                case 'A': code = 0; break;
+                case 'C': code = 1; break;
+                case 'G': code = 2; break;
+                case 'T': code = 3; break;
+                default:
+                    if(n >= 0 || !mismatches_) return -1;
+                    n = i;
+                    code = 0;
+            }
+            key = key << 2 | code;
+        }
+        if(n >= 0) {
+            int found = -1;
+            for(uint64_t code = 0; code < 4; code++) {
+                uint64_t k = key | code << 2 * (length_ - 1 - n);
+                const uint32_t* v = table_.find(k);
+                if(!v || *v == AMBIGUOUS || keys_[*v] != k)
+                    continue;
+                if(found >= 0) return -1;
+                found = *v;
+            }
+            exact = false;
+            return found;
+        }
+        const uint32_t* v = table_.find(key);
+        if(!v || *v == AMBIGUOUS) return -1;
+        exact = keys_[*v] == key;
+        return *v;
+    }
+
+    // the 3 * length keys one substitution away
+    template <typename F>
+    static void for_each_neighbour(uint64_t key, int length, F f) {
+        for(int i = 0; i < length; i++)
+            for(uint64_t code = 1; code < 4; code++)
+                f(key ^ (code << 2 * i));
+    }
+
+private:
+    static const uint32_t AMBIGUOUS = ~(uint32_t)0;
+
+    umi_table table_;
+    std::vector<uint64_t> keys_;
+    int length_;
+    bool mismatches_;
+};
+
+struct umi_stats {
+    uint64_t exact, corrected, failed;
+    umi_stats(): exact(0), corrected(0), failed(0) {}
+    void add(const umi_stats& s) { exact += s.exact; corrected += s.corrected; failed += s.failed; }
+};
+
+// Corrects the UMI written into read names, the UMI of read1 and of read2
+// joined by a connector, either of them possibly empty. With a whitelist each
+// read's UMI is snapped to the single whitelisted UMI within one mismatch.
+// With directional clustering (as in UMI-tools) both are one key; a UMI seen
+// n times absorbs its one-mismatch neighbours seen at most (n + 1) / 2 times,
+// transitively, and every UMI of a cluster is rewritten to the most abundant
+// one. All tables are built before the workers start and only read afterwards.
+class umi_corrector {
+public:
+    enum mode { NONE, WHITELIST, CLUSTER };
+
+    umi_corrector(): mode_(NONE), overflow_(0) { lengths_[0] = lengths_[1] = 0; }
+
+    mode kind() const { return mode_; }
+
+    // The UMIs of read1 and read2 must both be empty or whitelist long.
+    bool load_whitelist(const std::string& path, int length1, int length2, std::string& error) {
+        std::ifstream in(path.c_str());
+        if(!in) {
+            error = "can not open " + path;
+            return false;
+        }
+        mode_ = WHITELIST;
+        lengths_[0] = length1;
+        lengths_[1] = length2;
+        int length = std::max(length1, length2);
+        std::vector<uint64_t> whitelist;
+        std::string line;
+        while(std::getline(in, line)) {
+            if(!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+            if(line.empty()) continue;
+            uint64_t key;
+            if((int)line.size() != length || !encode_umi(line.data(), length, key)) {
+                error = "whitelist UMI " + line + " is not " + std::to_string(length) + " ACGT bases";
+                return false;
+            }
+            whitelist.push_back(key);
+        }
+        std::sort(whitelist.begin(), whitelist.end());
+        whitelist.erase(std::unique(whitelist.begin(), whitelist.end()), whitelist.end());
+        whitelist_.build(whitelist, length, true);
+        return true;
+    }
+
+    // directional clustering needs the abundance of every UMI up front
+    void start_counting(int length1, int length2, size_t max_distinct) {
+        mode_ = CLUSTER;
+        lengths_[0] = length1;
+        lengths_[1] = length2;
+        table_ = umi_table(max_distinct);
+        overflow_ = 0;
+    }
+
+    void count(const std::string& umi) {
+        uint64_t key;
+        if(!encode_pair(umi, key)) return;
+        uint32_t* v = table_.insert(key, 0);
+        if(v) (*v)++;
+        else overflow_++;
+    }
+
+    // UMIs never counted because the table was full
+    uint64_t overflow() const { return overflow_; }
+    size_t distinct() const { return table_.size(); }
+
+    // turns the counts into the index + 1 of each UMI's cluster head in targets_
+    void cluster() {
+        std::vector<std::pair<uint32_t, uint64_t> > order;
+        order.reserve(table_.size());
+        table_.for_each([&](uint64_t key, uint32_t n) { order.push_back(std::make_pair(n, key)); });
+        std::sort(order.begin(), order.end(), [](const std::pair<uint32_t, uint64_t>& a, const std::pair<uint32_t, uint64_t>& b) {
+            return a.first != b.first? a.first > b.first: a.second < b.second;
+        });
+        umi_table counts = table_;
+        table_ = umi_table();
+        targets_.clear();
+        std::vector<uint64_t> queue;
+        for(size_t i = 0; i < order.size(); i++) {
+            if(table_.find(order[i].second)) continue;
+            targets_.push_back(order[i].second);
+            uint32_t head = targets_.size();
+            queue.assign(1, order[i].second);
+            *table_.insert(order[i].second, head) = head;
+            while(!queue.empty()) {
+                uint64_t key = queue.back();
+                queue.pop_back();
+                uint32_t n = *counts.find(key);
+                neighbour_index::for_each_neighbour(key, lengths_[0] + lengths_[1], [&](uint64_t m) {
+                    const uint32_t* c = counts.find(m);
+                    if(c && n + 1 >= 2 * *c && !table_.find(m)) {
+                        table_.insert(m, head);
+                        queue.push_back(m);
+                    }
+                });
+            }
+        }
+    }
+
+    size_t clusters() const { return targets_.size(); }
+
+    // rewrites the bases of umi in place
+    void correct(std::string& umi, umi_stats& stats) const {
+        if(mode_ == WHITELIST) {
+            bool exact = true, failed = false;
+            for(int s = 0; s < 2; s++) {
+                if(!lengths_[s]) continue;
+                char* segment = &umi[offset(s)];
+                bool same;
+                int i = whitelist_.find(segment, same);
+                if(i < 0) {
+                    failed = true;
+                    continue;
+                }
+                if(!same) {
+                    exact = false;
+                    decode_umi(whitelist_.key(i), lengths_[s], segment);
+                }
+            }
+            count_outcome(stats, exact, failed);
+        } else if(mode_ == CLUSTER) {
+            uint64_t key;
+            const uint32_t* v = encode_pair(umi, key)? table_.find(key): nullptr;
+            if(!v) {
+                stats.failed++;
+                return;
+            }
+            uint64_t head = targets_[*v - 1];
+            if(head == key) {
+                stats.exact++;
+                return;
+            }
+            for(int s = 1; s >= 0; head >>= 2 * lengths_[s], s--)
+                decode_umi(head, lengths_[s], &umi[offset(s)]);
+            stats.corrected++;
+        }
+    }
+
+private:
+    static void count_outcome(umi_stats& stats, bool exact, bool failed) {
+        if(failed) stats.failed++;
+        else if(exact) stats.exact++;
+        else stats.corrected++;
+    }
+
+    // where the UMI of read s starts, behind the connector if read1 has one
+    int offset(int s) const { return s == 0 || !lengths_[0]? 0: lengths_[0] + 1; }
+
+    bool encode_pair(const std::string& umi, uint64_t& key) const {
+        key = 1;
+        for(int s = 0; s < 2; s++) {
+            uint64_t k;
+            if(!lengths_[s]) continue;
+            if(!encode_umi(&umi[offset(s)], lengths_[s], k))
+                return false;
+            key = key << 2 * lengths_[s] | (k & ((1ULL << 2 * lengths_[s]) - 1));
+        }
+        return true;
+    }
+
+    mode mode_;
+    int lengths_[2];  // UMI bases taken from read1 and read2
+    neighbour_index whitelist_;
+    umi_table table_;  // UMI counts, then the cluster of every UMI
+    std::vector<uint64_t> targets_;
+    uint64_t overflow_;
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// A zst file as written by --format zst is one zstd frame per batch, after
+// a skippable frame holding the dictionary the frames were compressed with:
+//
+//   dictionary := u32 0x184D2A5E | u32 size | "FQZD" dictionary bytes
+//
+// size counts "FQZD" and the dictionary. Any other zstd file reads as well.
+const uint32_t ZSTD_DICT_MAGIC = 0x184D2A5E;
+const uint32_t ZSTD_FRAME_MAGIC = 0xFD2FB528;
+const size_t ZSTD_DICT_CAPACITY = 110 << 10;  // as the zstd tool trains
+
+// true if the file starts like a zstd or skippable frame
+inline bool zstd_magic(const char* p, size_t l) {
+    if(l < 4)
+        return false;
+    uint32_t magic = 0;
+    for(int i = 0; i < 4; i++) magic |= (uint32_t)(unsigned char)p[i] << (8 * i);
+    return magic == ZSTD_FRAME_MAGIC || (magic & 0xFFFFFFF0) == 0x184D2A50;
+}
+
+// the codec itself is built in with make ZSTD=1
+#ifdef HAVE_ZSTD
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <zdict.h>
+#include <zstd.h>
+
+// Dictionary trained from sample records or loaded from a file, shared
+// read-only by the workers once prepared.
+class zstd_dictionary {
+public:
+    zstd_dictionary(): cdict_(nullptr) {}
+    ~zstd_dictionary() { ZSTD_freeCDict(cdict_); }
+
+    // samples are records back to back, sizes their lengths
+    bool train(const std::string& samples, const std::vector<size_t>& sizes, std::string& error) {
+        dict_.resize(ZSTD_DICT_CAPACITY);
+        size_t n = ZDICT_trainFromBuffer(&dict_[0], dict_.size(), samples.data(), sizes.data(), sizes.size());
+        if(ZDICT_isError(n)) {
+            dict_.clear();
+            error = ZDICT_getErrorName(n);
+            return false;
+        }
+        dict_.resize(n);
+        return true;
+    }
+
+    bool load(const std::string& path, std::string& error) {
+        std::ifstream in(path.c_str(), std::ios::binary);
+        if(!in) {
+            error = "can not open " + path;
+            return false;
+        }
+        std::ostringstream bytes;
+        bytes << in.rdbuf();
+        dict_ = bytes.str();
+        if(dict_.empty()) {
+            error = path + " is empty";
+            return false;
+        }
+        return true;
+    }
+
+    void prepare(int level) {
+        if(!dict_.empty() && !cdict_)
+            cdict_ = ZSTD_createCDict(dict_.data(), dict_.size(), level);
+    }
+
+    void clear() {
+        dict_.clear();
+        ZSTD_freeCDict(cdict_);
+        cdict_ = nullptr;
+    }
+
+    const ZSTD_CDict* cdict() const { return cdict_; }
+
+    // the skippable frame carrying the dictionary, nothing without one
+    std::string frame() const {
+        std::string out;
+        if(dict_.empty())
+            return out;
+        uint32_t words[2] = {ZSTD_DICT_MAGIC, (uint32_t)(dict_.size() + 4)};
+        for(int w = 0; w < 2; w++)
+            for(int i = 0; i < 4; i++) out += (char)(words[w] >> (8 * i));
+        out.append("FQZD", 4);
+        out += dict_;
+        return out;
+    }
+
+private:
+    std::string dict_;
+    ZSTD_CDict* cdict_;
+};
+
+// compresses blocks into single frames, one per worker
+class zstd_compressor {
+public:
+    zstd_compressor(): cctx_(ZSTD_createCCtx()) {}
+    ~zstd_compressor() { ZSTD_freeCCtx(cctx_); }
+
+    // with the dictionary if there is one, dict may be nullptr
+    bool compress(const std::string& text, std::string& out, int level, const zstd_dictionary* dict) {
+        out.resize(ZSTD_compressBound(text.size()));
+        size_t n = dict && dict->cdict()?
+            ZSTD_compress_usingCDict(cctx_, &out[0], out.size(), text.data(), text.size(), dict->cdict()):
+            ZSTD_compressCCtx(cctx_, &out[0], out.size(), text.data(), text.size(), level);
+        out.resize(ZSTD_isError(n)? 0: n);
+        return !ZSTD_isError(n);
+    }
+
+private:
+    ZSTD_CCtx* cctx_;
+};
+
+// Streams the frames of a zstd file, taking the dictionary from a leading
+// dictionary frame. The head of the file is held back until it is known
+// whether it is one, then replayed to the decoder if not.
+class zstd_decoder {
+public:
+    zstd_decoder(): dctx_(ZSTD_createDCtx()), ddict_(nullptr), state_(START), dict_size_(0), replayed_(0),
+        flushing_(false), mid_frame_(false) {}
+    ~zstd_decoder() {
+        ZSTD_freeDCtx(dctx_);
+        ZSTD_freeDDict(ddict_);
+    }
+
+    // true while the decoder may hold output without any more input
+    bool flushing() const { return flushing_; }
+    // true if the input stopped inside a frame
+    bool mid_frame() const { return mid_frame_; }
+
+    // Decodes from in, taking what it consumed off in and in_l, into out.
+    // Returns the bytes written, 0 when more input is needed and -1 if the
+    // data is corrupt. eof says no input will follow.
+    long decode(const char*& in, size_t& in_l, char* out, size_t len, bool eof) {
+        while(state_ != FRAMES) {
+            size_t want = state_ == START? 12 - head_.size(): dict_size_ - dict_.size();
+            size_t n = std::min(want, in_l);
+            (state_ == START? head_: dict_).append(in, n);
+            in += n;
+            in_l -= n;
+            if(n < want && !eof)
+                return 0;
+            if(state_ == DICT) {
+                if(n < want) {
+                    mid_frame_ = true;
+                    return 0;
+                }
+                ddict_ = ZSTD_createDDict(dict_.data(), dict_.size());
+                if(!ddict_ || ZSTD_isError(ZSTD_DCtx_refDDict(dctx_, ddict_)))
+                    return -1;
+                state_ = FRAMES;
+            } else if(head_.size() == 12 && get_u32(&head_[0]) == ZSTD_DICT_MAGIC && !head_.compare(8, 4, "FQZD")) {
+                dict_size_ = get_u32(&head_[4]) - 4;
+                head_.clear();
+                state_ = DICT;
+            } else {
+                state_ = FRAMES;
+            }
+        }
+        ZSTD_outBuffer ob = {out, len, 0};
+        while(ob.pos < ob.size) {
+            bool replay = replayed_ < head_.size();
+            ZSTD_inBuffer ib = {replay? head_.data(): in, replay? head_.size(): in_l, replay? replayed_: 0};
+            if(ib.pos == ib.size && !flushing_)
+                break;
+            size_t before = ob.pos;
+            size_t r = ZSTD_decompressStream(dctx_, &ob, &ib);
+            if(ZSTD_isError(r))
+                return -1;
+            mid_frame_ = r != 0;
+            flushing_ = ob.pos == ob.size;
+            if(replay) {
+                replayed_ = ib.pos;
+            } else {
+                in += ib.pos;
+                in_l -= ib.pos;
+            }
+            if(ob.pos == before && ib.pos == ib.size)
+                flushing_ = false;
+        }
+        return ob.pos;
+    }
+
+private:
+    enum state { START, DICT, FRAMES };
+
+    static uint32_t get_u32(const char* p) {
+        uint32_t v = 0;
+        for(int i = 0; i < 4; i++) v |= (uint32_t)(unsigned char)p[i] << (8 * i);
+        return v;
+    }
+
+    ZSTD_DCtx* dctx_;
+    ZSTD_DDict* ddict_;
+    state state_;
+    std::string head_, dict_;
+    size_t dict_size_, replayed_;
+    bool flushing_, mid_frame_;
+};
+#endif